@@ -32,7 +32,9 @@ TODO:
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <avr/io.h>
 #include <avr/eeprom.h>
@@ -41,6 +43,8 @@ TODO:
 #include <util/delay.h>
 #include <avr/sleep.h>
 #include <avr/wdt.h>
+#include <util/atomic.h>
+#include "prng.h"
 
 #define CELLLEN 16
 
@@ -57,98 +61,831 @@ TODO:
 #define high(port, pin) (port |= _BV(pin))
 #define PI 3.1415926535897932384626433832795
 #define BET(A, B, C) (((A >= B) && (A <= C)) ? 1 : 0) /* a between [b,c] */
-#define ARRAY_SIZE (MAX_SAM + 12)					  /* Safe array bounds */
-#define SAFE_IDX(idx) ((idx) % ARRAY_SIZE)			  /* Bounds check macro */
+#define CELLS_LEN 256								  /* Cell space, VMState.cells */
+#define ARRAY_SIZE CELLS_LEN						  /* Safe array bounds */
+#define SAFE_IDX(idx) ((unsigned char)(idx))		  /* Bounds check macro: 8-bit wraparound, no division */
 #define NSTEPS 10000
 #define recovered 129
 #define dead 255
 #define susceptible 0
 #define tau 2
 
-signed char insdir, dir; // Defines the direction
-unsigned char filterk, cpu, plague, step, hardk, fhk, instruction, instructionp, IP, controls, hardware, samp, count, qqq;
+#define DISPATCH_TABLE 0	   // Function pointer tables, one icall per instruction
+#define DISPATCH_SWITCH 1	   // Dense switch per instruction set, small handlers are inlined
+#define DISPATCH DISPATCH_SWITCH // Selected instruction dispatch
+
+#define OPCACHE 1 // 1: pre-decoded opcode cache (CELLS_LEN bytes RAM), 0: decode with % N
+
+#define HODGE_ONE 0	   // hodge() does one cell per step
+#define HODGE_BUDGET 1 // hodge() does as many cells as fit in PLAGUE_BUDGET
+#define HODGE_FULL 2   // hodge() does a whole generation per step
+#define HODGE_STEP HODGE_BUDGET
+
+#define LIFE_PACKED 1 // 1: bit-packed 16x16 life, one generation per step, 0: byte life on the half-spaces
+#define SIR_ACTIVE 1  // 1: SIR only visits the epidemic front (56 bytes RAM), 0: sweep every cell
+#define DIRTY_ROWS 1  // 1: life() and hodge() recompute only rows next to changed rows, 0: every row
+#define BF_LINKED 1	  // 1: Brainfuck bracket links and run lengths kept in the opcache, 0: bracket stack
+#if BF_LINKED && !OPCACHE
+#error "BF_LINKED needs OPCACHE"
+#endif
+#define REDCODE_CACHE 8 // Decoded Redcode records (3 bytes each, power of two, needs OPCACHE), 0: decode every step
+#define REDCODE_TASKS 1 // Redcode processes (power of two), > 1: jmg becomes SPL and dat ends a process
+#if REDCODE_CACHE && !OPCACHE
+#error "REDCODE_CACHE needs OPCACHE"
+#endif
+#define SUPERINSN 0 // 1: hot instructionsetfirst sequences run fused in one step (needs OPCACHE), 0: one instruction per step
+#if SUPERINSN && !OPCACHE
+#error "SUPERINSN needs OPCACHE"
+#endif
+#define VM_CORES 1 // virtual CPUs on the one cell space, round robin per CPU tick, their samples mixed (1, 2 or 4)
+#if VM_CORES != 1 && VM_CORES != 2 && VM_CORES != 4
+#error "VM_CORES must be 1, 2 or 4"
+#endif
+
+#define AUDIO_RATE 16000UL							   // Output sample rate in Hz (7813 .. 2000000)
+#define AUDIO_FIFO_LEN 16							   // Sample FIFO depth, must be a power of two
+#define AUDIO_FIFO_MASK (AUDIO_FIFO_LEN - 1)		   // Wrap mask for FIFO indices
+#define AUDIO_OCR2A ((F_CPU / 8 / AUDIO_RATE) - 1) // Timer2 TOP for AUDIO_RATE at prescaler /8
+
+#define SCHED_TICK_US (1000000UL / AUDIO_RATE) // Scheduler tick, one per audio sample (62 us at 16 kHz)
+#define CPU_TICKS 1							   // Ticks per left knob step, CPU period = ((IP & 31) + 1) * CPU_TICKS
+#define PLAGUE_TICKS 1						   // Ticks per right knob step, plague period = step * PLAGUE_TICKS
+#define PLAGUE_BUDGET 512					   // Cycles per plague step (at least one cell), a tick is F_CPU / AUDIO_RATE = 1000
+#if 32 * CPU_TICKS > 127 || 32 * PLAGUE_TICKS > 127
+#error "task periods must stay below 128 ticks"
+#endif
+
+#define ADC_CHANNELS 4										  // Channels 0-3 are scanned, must be a power of two
+#define ADC_SEQ_LEN 6										  // Length of the scan sequence
+#define ADC_PRESCALER ((1 << ADPS2) | (1 << ADPS1))			  // ADC clock prescaler /64
+#define ADC_DIV 64											  // Same prescaler as a number
+#define CAPTURE_CHANNEL 3									  // Feedback signal, every second conversion
+#define CAPTURE_LEN 32										  // Capture ring size, must be a power of two
+#define CAPTURE_MASK (CAPTURE_LEN - 1)						  // Wrap mask for the capture ring
+#define CAPTURE_RATE (F_CPU / ADC_DIV / 13 / 2)				  // Capture sample rate in Hz (9615)
+
+unsigned char filterk, cpu, plague, step, hardk, fhk, instruction, IP, controls, hardware, samp, qqq;
 
-static unsigned char xxx[MAX_SAM + 12];
-
-unsigned char ostack[20], stack[20], omem;
-
-unsigned char btdir, dcdir;
-
-unsigned char controls;
-
-unsigned char clock, count;
-
-unsigned char cycle;
+/*
+Interpreter State
+Everything an instruction handler reads or writes besides the hardware:
+the registers first, then the cell space at the fixed offset VM_CELLS.
+Handlers get the VM as a pointer, GCC keeps it in Y or Z, so a register
+is one LDD/STD with a displacement below 64 instead of a 2-word LDS/STS,
+and a cell is the base plus the 8-bit index (always in bounds).
+The IP stays an argument and the return value, it lives in registers.
+main() hides the address of vm_board from the optimiser, a constant
+pointer would be folded back into absolute addresses.
+*/
+typedef struct
+{
+	unsigned char ip;			// instruction pointer, cell of the next instruction
+	signed char insdir, dir;	// step of the instruction pointer, direction for the next step
+	unsigned char omem;			// data pointer
+	unsigned char btdir, dcdir; // biota: heading of the instruction pointer, of omem
+	unsigned char clock, count; // reddeath: midnight clock, CPU steps
+	unsigned char out;			// last sample played (read-modify-write outputs)
+#if !BF_LINKED
+	unsigned char cycle;	  // Brainfuck bracket stack depth
+	unsigned char ostack[20]; // Brainfuck bracket stack
+#endif
+#if REDCODE_TASKS > 1
+	unsigned char rd_task[REDCODE_TASKS]; // waiting Redcode processes, round robin
+	unsigned char rd_head, rd_ntask;	  // oldest waiting process, number waiting
+	unsigned char rd_in;				  // the last step ran Redcode, the queue belongs to this program
+#endif
+	unsigned char cells[CELLS_LEN]; // cell space, any 8-bit index is in bounds without a modulo
+} VMState;
+
+#define VM_CELLS offsetof(VMState, cells) // the registers before it are in reach of LDD
+_Static_assert(VM_CELLS <= 64, "VMState registers must stay within LDD displacement reach");
+
+static VMState vm_board; // the interpreter this firmware runs
+
+static volatile unsigned char audio_fifo[AUDIO_FIFO_LEN]; // Samples waiting for the Timer2 ISR
+static volatile unsigned char audio_head, audio_tail;	  // head: written by main loop, tail: written by ISR
+static volatile unsigned char sched_ticks;				  // Audio samples since boot, scheduler time base
+volatile unsigned int audio_underruns;					  // FIFO ran dry while samples were coming, saturates at 65535
+static volatile unsigned char audio_armed;				  // a sample was pushed since the FIFO last ran dry
+unsigned int audio_overruns;							  // FIFO was full and a sample was dropped
+
+typedef struct
+{
+	unsigned char ch[ADC_CHANNELS];
+} AdcSnapshot;
+
+static const unsigned char adc_seq[ADC_SEQ_LEN] PROGMEM = {3, 0, 3, 1, 3, 2}; // Channel scan order, capture channel interleaved
+static volatile AdcSnapshot adc_buf[2];						   // ISR fills adc_buf[adc_front ^ 1]
+static volatile unsigned char adc_front;					   // Index of the last complete sweep
+static volatile unsigned char adc_slot;						   // Sequence position of the conversion in flight
+volatile unsigned char adc_frames;							   // Number of complete sweeps
+static volatile unsigned char cap_ring[CAPTURE_LEN];			   // Last CAPTURE_LEN samples of CAPTURE_CHANNEL
+static volatile unsigned char cap_head;						   // Next write position in cap_ring
 
 /*
 Initialize Analog Digital Converter (ADC)
 Reference Voltage to AVCC
-Single Conversion Mode
+Free Running Mode, ADC_vect scans the channels in adc_seq[]
 Left Adjusted Results
 Activate ADC
+The MUX of the first conversion is latched one ADC clock after ADSC,
+the second channel is written only after that.
 */
 void adc_init(void)
 {
 	cbi(ADMUX, REFS1);	// clear ReferenceSelection Bit1
 	sbi(ADMUX, REFS0);	// set voltage reference to AVCC
 	sbi(ADMUX, ADLAR);	// 8 bits (ADC Left Adjust Result)
-	sbi(ADCSRA, ADPS2); // set ADC clock here TODO: Warum ADPS2? Wie schnell läuft der Chip?
-	//	sbi(ADCSRA, ADPS0); // change speed here!
-	sbi(ADCSRA, ADEN); // ADC Enable - activate!
+	ADCSRA |= ADC_PRESCALER; // 16 MHz / 64 = 250 kHz ADC clock, 13 cycles per conversion
 	DDRC = 0x00;
 	PORTC = 0x00;
+
+	adc_slot = 0;
+	adc_front = 0;
+	ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[0]);
+	ADCSRB &= ~((1 << ADTS2) | (1 << ADTS1) | (1 << ADTS0));		   // auto trigger source: free running
+	ADCSRA |= (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | (1 << ADSC); // ADC Enable - activate!
+	_delay_us(2.0 * ADC_DIV * 1000000 / F_CPU);					   // two ADC clocks, the first conversion latched its MUX
+	ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[1]);			   // for the second conversion
+}
+
+/*
+ADC Scanner
+In free running mode the next conversion has already started with the old
+MUX setting when this ISR runs, so the MUX is programmed two slots ahead.
+Every conversion of CAPTURE_CHANNEL is also streamed into cap_ring, which
+gives the feedback signal a fixed sample rate of CAPTURE_RATE.
+A finished sweep flips the double buffer.
+*/
+ISR(ADC_vect)
+{
+	unsigned char s = adc_slot, next, ch = pgm_read_byte(&adc_seq[s]), v = ADCH;
+	adc_buf[adc_front ^ 1].ch[ch] = v;
+	if (ch == CAPTURE_CHANNEL)
+	{
+		cap_ring[cap_head] = v;
+		cap_head = (cap_head + 1) & CAPTURE_MASK;
+	}
+	if (++s == ADC_SEQ_LEN)
+		s = 0;
+	next = s + 1;
+	if (next == ADC_SEQ_LEN)
+		next = 0;
+	ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[next]);
+	if (s == 0)
+	{
+		adc_front ^= 1;
+		adc_frames++;
+	}
+	adc_slot = s;
 }
 
 /*
-Sets Channel, Read and Return ADC Results
+Return the latest conversion Result of a channel, never blocks
 */
 unsigned char adcread(unsigned char channel)
 {
+	return adc_buf[adc_front].ch[channel & (ADC_CHANNELS - 1)];
+}
+
+/*
+Copy the last complete sweep of all channels
+*/
+void adc_snapshot(AdcSnapshot *snap)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*snap = adc_buf[adc_front];
+	}
+}
+
+/*
+Wait for the next complete sweep (only used while booting)
+*/
+void adc_wait(void)
+{
+	unsigned char frame = adc_frames;
+	while (frame == adc_frames)
+	{
+	}
+}
 
-	// #ifndef DEBUG
-	ADMUX &= 0xF8;						 // clear existing channel selection
-	ADMUX |= (channel & 0x07);			 // set channel/pin
-	ADCSRA |= (1 << ADSC);				 // ADC Start Conversion
-	loop_until_bit_is_set(ADCSRA, ADIF); /* Wait for ADC Interrupt Flag, will happen soon */
-	return (ADCH);						 // Return Conversion Results (Only low bits from ADC Data Register)
-										 /*#endif
-									 
-										 #ifdef DEBUG
-										  return (rand()%254)+1; // ensure non-zero fallback
-										 #endif
-										 */
+/*
+Seed the PRNG from ADC noise (only used while booting)
+*/
+void seed_rng(void)
+{
+	unsigned char i, seed = 0;
+	for (i = 0; i < 16; i++)
+	{
+		adc_wait();
+		seed ^= adcread(3);
+	}
+	prng_seed(seed);
 }
+
 /*
 Create a array of values from output signal(acdread(3)) as sample storage
 */
 void initcell(unsigned char *cells)
 {
-	unsigned char x;
-	for (x = 0; x < MAX_SAM; x++)
+	unsigned int x;
+	for (x = 0; x < CELLS_LEN; x++)
 	{
+		adc_wait();			   // take a fresh sample for every cell
 		cells[x] = adcread(3); // get output signal
 	}
 }
 
+/*
+Registers of a VM as after power-up, the cells are left alone
+*/
+void vm_reset(VMState *vm)
+{
+	memset(vm, 0, VM_CELLS);
+	vm->insdir = 1; // Step size for instruction Pointer - only changes in plwalk()
+	vm->dir = 1;	// Direction for the next step
+}
+
+/*
+Initialize Audio Engine
+Timer2 in CTC mode, prescaler /8, fires TIMER2_COMPA at AUDIO_RATE
+The ISR is the only place that writes OCR0A
+*/
+void audio_init(void)
+{
+	audio_head = 0;
+	audio_tail = 0;
+	TCCR2A = (1 << WGM21); // clear timer on compare match, TOP is OCR2A
+	TCCR2B = (1 << CS21);  // prescaler /8
+	OCR2A = AUDIO_OCR2A;
+	TIMSK2 |= (1 << OCIE2A); // enable compare match A interrupt
+}
+
+/*
+Push one sample into the FIFO (main loop side, single producer)
+Drops the sample and counts an overrun if the ISR can't keep up
+*/
+void audio_push(unsigned char sample)
+{
+	unsigned char next = (audio_head + 1) & AUDIO_FIFO_MASK;
+	if (next == audio_tail)
+	{
+		audio_overruns++;
+		return;
+	}
+	audio_fifo[audio_head] = sample;
+	audio_head = next; // publish after the sample is stored
+	audio_armed = 1;
+}
+
+#if VM_CORES > 1
+static unsigned char cores_played; // a core played a sample in this round
+#endif
+
+/*
+A VM plays a sample. With several cores it is mixed with the others at the
+end of the round (cores_run()), every core counts with its last sample.
+*/
+static inline void vm_play(VMState *vm, unsigned char sample)
+{
+	vm->out = sample;
+#if VM_CORES > 1
+	cores_played = 1;
+#else
+	audio_push(sample);
+#endif
+}
+
+/*
+Fixed rate sample output (ISR side, single consumer)
+On an empty FIFO OCR0A keeps the last sample. Only the first empty tick
+after a push counts as an underrun, a program that plays nothing (or
+rarely) is not late.
+*/
+ISR(TIMER2_COMPA_vect)
+{
+	unsigned char t = audio_tail;
+	sched_ticks++; // scheduler time base
+	if (t == audio_head)
+	{
+		if (audio_armed && audio_underruns != 0xFFFF)
+			audio_underruns++;
+		audio_armed = 0;
+		return;
+	}
+	OCR0A = audio_fifo[t];
+	audio_tail = (t + 1) & AUDIO_FIFO_MASK;
+}
+
+/*
+Scheduler
+The audio ISR doubles as the time base, one tick per sample. main() polls
+the tasks, so the CPU and plague tempo follow the knobs and not the time a
+loop pass takes. A task more than one period late drops the backlog and
+counts a missed deadline instead of firing in a burst.
+The tick counter is 8 bit (atomic to read), periods must stay below 128.
+*/
+typedef struct
+{
+	unsigned char period; // ticks between runs
+	unsigned char due;	  // tick of the next run
+	unsigned int missed;  // deadlines missed by a whole period
+} Task;
+
+Task task_cpu = {1, 0, 0}, task_plague = {1, 0, 0};
+
+static inline unsigned char task_due(Task *t)
+{
+	unsigned char late = sched_ticks - t->due;
+
+	if (late & 0x80) // due is still ahead
+		return 0;
+	if (late >= t->period)
+	{
+		t->missed++;
+		t->due = sched_ticks + t->period;
+	}
+	else
+		t->due += t->period;
+	return 1;
+}
+
+/*
+New period from a knob, a shorter period takes effect right away
+*/
+static inline void task_period(Task *t, unsigned char period)
+{
+	unsigned char now = sched_ticks;
+	unsigned char ahead = t->due - now;
+
+	t->period = period;
+	if (ahead > period && ahead < 0x80)
+		t->due = now + period;
+}
+
+/*
+Opcode Cache
+cells[i] reduced to an opcode of the active instruction set, so dispatch is a
+single load instead of a % N division call. Costs CELLS_LEN bytes of RAM.
+The reduction uses a multiply by ceil(65536 / N), exact for all 8-bit values.
+Refilled when the instruction set changes, kept up to date by cell_wrote().
+*/
+#if OPCACHE
+static unsigned char opcache[CELLS_LEN];									// Decoded opcodes of instruction set opcache_cpu
+static unsigned char opcache_cpu = 0xFF;									// Instruction set of the cached opcodes, 0xFF = empty
+unsigned int opcache_fills, opcache_updates;								// Full refills (CELLS_LEN decodes) / single updates
+static const unsigned char opcache_n[8] PROGMEM = {26, 8, 9, 6, 11, 0, 7, 10};	// Instructions per set, 0 = not decoded
+static const unsigned int opcache_m[8] PROGMEM = {2521, 8192, 7282, 10923, 5958, 0, 9363, 6554}; // ceil(65536 / n)
+
+static inline unsigned char op_reduce(unsigned char v, unsigned char set)
+{
+	unsigned char q = ((unsigned long)v * pgm_read_word(&opcache_m[set])) >> 16;
+	return v - q * pgm_read_byte(&opcache_n[set]);
+}
+
+#if BF_LINKED
+/*
+Brainfuck Links
+For the Brainfuck set an opcache entry carries more than the opcode:
+  op | run << 3                 > < + - and the rest, run = cells with the
+                                same opcode from here on (1..15, folded
+                                for > < + -)
+  BF_BRACKET | BF_CLOSE? | slot [ and ], slot indexes bf_link[]
+bf_link[slot] is the XOR of the two bracket positions, so either end finds
+the other with one load. Runs are fixed when a cell is written, the links
+are rebuilt (one pass, no extra RAM) before the next bracket executes after
+a bracket cell appeared or went away.
+*/
+#define BF_BRACKET 0x80
+#define BF_CLOSE 0x40
+#define BF_LINKS 32	 // bracket pairs, further brackets are no-ops
+#define BF_NOLINK 0x3F // unmatched bracket
+
+static unsigned char bf_link[BF_LINKS];
+static unsigned char bf_stale; // brackets changed since bf_relink()
+
+/*
+Opcode of an entry, 0..8 like op_reduce()
+*/
+static inline unsigned char bf_op(unsigned char e)
+{
+	if (e & BF_BRACKET)
+		return (e & BF_CLOSE) ? 8 : 7;
+	return e & 7;
+}
+
+/*
+Entry for cell i holding opcode op, the run continues into cell i + 1
+*/
+static inline unsigned char bf_code(unsigned char i, unsigned char op)
+{
+	unsigned char run = 1;
+	if (op >= 7)
+		return BF_BRACKET | (op == 8 ? BF_CLOSE : 0) | BF_NOLINK;
+	if (op < 4 && i != CELLS_LEN - 1 && (opcache[i + 1] & (BF_BRACKET | 7)) == op)
+	{
+		run = (opcache[i + 1] >> 3) + 1;
+		if (run > 15)
+			run = 15;
+	}
+	return op | run << 3;
+}
+
+/*
+Match the brackets, the pending [ slots are stacked from the top of bf_link[]
+*/
+static void bf_relink(void)
+{
+	unsigned char i = 0, e, s, n = 0, top = BF_LINKS, over = 0;
+	do
+	{
+		e = opcache[i];
+		if (e & BF_BRACKET)
+		{
+			s = BF_NOLINK;
+			if (!(e & BF_CLOSE))
+			{
+				if (!over && n < top - 1)
+				{
+					s = n++;
+					bf_link[s] = i;
+					bf_link[--top] = s;
+				}
+				else
+					over++; // out of slots, nested brackets stay unmatched
+			}
+			else if (over)
+				over--;
+			else if (top < BF_LINKS)
+			{
+				s = bf_link[top++];
+				bf_link[s] ^= i;
+			}
+			opcache[i] = (e & (BF_BRACKET | BF_CLOSE)) | s;
+		}
+	} while (++i);
+	while (top < BF_LINKS) // [ without ]
+	{
+		s = bf_link[top++];
+		opcache[bf_link[s]] = BF_BRACKET | BF_NOLINK;
+	}
+	bf_stale = 0;
+}
+
+/*
+Cell i now holds opcode op, fix the runs that end in it
+*/
+static void bf_wrote(unsigned char i, unsigned char op)
+{
+	unsigned char e;
+	if (op >= 7 || (opcache[i] & BF_BRACKET))
+		bf_stale = 1;
+	opcache[i] = bf_code(i, op);
+	while (i)
+	{
+		e = opcache[--i];
+		if (e & BF_BRACKET)
+			break;
+		op = bf_code(i, e & 7);
+		if (op == e)
+			break; // runs further back are the same
+		opcache[i] = op;
+	}
+}
+#endif
+
+#if REDCODE_CACHE
+/*
+Redcode Records
+A Redcode instruction is three cells: opcode, A-field, B-field. A record
+keeps the operands of one instruction as absolute addresses (or plain
+values for outf / outp), direct-mapped by the opcode cell. A write to any of
+the three cells drops the record. Valid while the opcache holds the
+Redcode set, a refill flushes them.
+*/
+typedef struct
+{
+	unsigned char ip; // opcode cell, the record covers ip .. ip + 2, ip & mask != slot = empty
+	unsigned char a;  // resolved A operand
+	unsigned char b;  // resolved B operand
+} RedRecord;
+
+static RedRecord rd_cache[REDCODE_CACHE];
+unsigned int rd_decodes; // records filled from the cells
+
+/*
+Forget the record of the instruction at ip
+*/
+static inline void rd_drop(unsigned char ip)
+{
+	RedRecord *r = &rd_cache[ip & (REDCODE_CACHE - 1)];
+	if (r->ip == ip)
+		r->ip = ip + 1; // lands in another slot, never matches
+}
+
+/*
+Cell i changed, drop the records covering it
+*/
+static void rd_wrote(unsigned char i)
+{
+	rd_drop(i);
+	rd_drop(i - 1);
+	rd_drop(i - 2);
+}
+#endif
+
+#if SUPERINSN
+/*
+Superinstructions
+Sequences of instructionsetfirst that dominate the profile of typical cell
+programs are marked in the top 3 bits of the opcache entry of their first
+cell, the opcode stays in the low 5 bits. run_first() executes a marked
+sequence as one fused handler while the program runs forward. The marks of
+cells i - 2 .. i are redone when cell i changes.
+*/
+#define OP_MASK 0x1F
+#define OP_FINC 2
+#define OP_FINCM 4
+#define OP_OUTP 11
+#define OP_PLUS 12
+#define OP_BITSHIFT1 14
+#define OP_JUMP 18
+
+#define SUPER_FINC_FINCM 1
+#define SUPER_FINC_FINCM_OUTP 2
+#define SUPER_FINCM_OUTP 3
+#define SUPER_PLUS_SHL 4
+#define SUPER_PLUS_SHL_JUMP 5
+
+unsigned int super_runs; // fused sequences executed
+
+/*
+Fused sequence starting at cell i, 0 = none
+*/
+static unsigned char super_find(unsigned char i)
+{
+	unsigned char a = opcache[i] & OP_MASK, b = opcache[SAFE_IDX(i + 1)] & OP_MASK, c = opcache[SAFE_IDX(i + 2)] & OP_MASK;
+	if (a == OP_FINC && b == OP_FINCM)
+		return c == OP_OUTP ? SUPER_FINC_FINCM_OUTP : SUPER_FINC_FINCM;
+	if (a == OP_FINCM && b == OP_OUTP)
+		return SUPER_FINCM_OUTP;
+	if (a == OP_PLUS && b == OP_BITSHIFT1)
+		return c == OP_JUMP ? SUPER_PLUS_SHL_JUMP : SUPER_PLUS_SHL;
+	return 0;
+}
+
+static inline void super_mark(unsigned char i)
+{
+	opcache[i] = (opcache[i] & OP_MASK) | super_find(i) << 5;
+}
+#endif
+
+/*
+Decode all cells for an instruction set
+*/
+void opcache_fill(unsigned char *cells, unsigned char set)
+{
+	unsigned int i;
+	opcache_cpu = set;
+	if (pgm_read_byte(&opcache_n[set]) == 0)
+		return;
+	for (i = 0; i < CELLS_LEN; i++)
+		opcache[i] = op_reduce(cells[i], set);
+#if BF_LINKED
+	if (set == 2)
+	{
+		for (i = CELLS_LEN; i--;)
+			opcache[i] = bf_code(i, opcache[i]);
+		bf_relink();
+	}
+#endif
+#if REDCODE_CACHE
+	if (set == 4)
+	{
+		for (i = 0; i < REDCODE_CACHE; i++)
+			rd_cache[i].ip = i + 1; // empty
+	}
+#endif
+#if SUPERINSN
+	if (set == 0)
+	{
+		for (i = 0; i < CELLS_LEN; i++)
+			super_mark(i);
+	}
+#endif
+	opcache_fills++;
+}
+#endif
+
+#if OPCACHE && VM_CORES > 1
+#define OPCODE(vm, set, n) ((set) == opcache_cpu ? opcache[(vm)->ip] : op_reduce((vm)->cells[(vm)->ip], (set))) // a core on another set decodes with a multiply
+#elif OPCACHE
+#define OPCODE(vm, set, n) (opcache[(vm)->ip]) // opcode of the current cell, no division
+#else
+#define OPCODE(vm, set, n) ((vm)->cells[(vm)->ip] % (n)) // opcode of the current cell
+#endif
+
+static unsigned char orbit_changed; // a cell changed since the last plague generation
+static unsigned int orbit_sig;		// signature of those changes
+
+static const unsigned char bit8[8] PROGMEM = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80}; // 1 << n without a shift loop
+
+/*
+Dirty-row masks, bit n = row n. Every consumer clears its own mask, so one
+plague consuming the writes does not hide them from another.
+*/
+#if LIFE_PACKED
+static unsigned int life_dirty = 0xFFFF; // Rows of the cell space written since life() packed them
+#endif
+#if DIRTY_ROWS
+static unsigned int hodge_dirty = 0xFFFF; // Half-space rows written since the last hodge() call, upper half-space in bits 8-15
+#endif
+#if SIR_ACTIVE
+static unsigned char sir_touched[16]; // Half-space offsets written since the last SIR() call
+#endif
+
+/*
+1 << r for a row r = 0..15, without a shift loop
+*/
+static inline unsigned int row_bit(unsigned char r)
+{
+	if (r & 8)
+		return (unsigned int)pgm_read_byte(&bit8[r & 7]) << 8;
+	return pgm_read_byte(&bit8[r & 7]);
+}
+
+/*
+Cell Write Barrier
+Every write into the cell space (handlers and plagues) that changes a cell
+reports here
+*/
+static inline void cell_wrote(unsigned char i, unsigned char v)
+{
+	orbit_changed = 1;
+	orbit_sig = ((orbit_sig << 1) | (orbit_sig >> 15)) ^ ((unsigned int)i << 8 | v);
+#if OPCACHE
+	if (opcache_cpu < 8 && pgm_read_byte(&opcache_n[opcache_cpu]))
+	{
+#if BF_LINKED
+		if (opcache_cpu == 2)
+			bf_wrote(i, op_reduce(v, 2));
+		else
+#endif
+			opcache[i] = op_reduce(v, opcache_cpu);
+#if REDCODE_CACHE
+		if (opcache_cpu == 4)
+			rd_wrote(i);
+#endif
+#if SUPERINSN
+		if (opcache_cpu == 0)
+		{
+			super_mark(i - 2);
+			super_mark(i - 1);
+			super_mark(i);
+		}
+#endif
+		opcache_updates++;
+	}
+#endif
+#if LIFE_PACKED
+	life_dirty |= row_bit(i >> 4);
+#endif
+#if DIRTY_ROWS
+	unsigned char h = 0; // hodge_dirty bits of the upper half-space start at 8
+	if (i >= MAX_SAM / 2)
+	{
+		i -= MAX_SAM / 2; // offset in the half-space, the upper one starts at 127
+		h = 8;
+	}
+	hodge_dirty |= row_bit(h | (i >> 4));
+#elif SIR_ACTIVE
+	if (i >= MAX_SAM / 2)
+		i -= MAX_SAM / 2;
+#endif
+#if SIR_ACTIVE
+	sir_touched[(i & 127) >> 3] |= pgm_read_byte(&bit8[i & 7]);
+#endif
+}
+
+/*
+Write one cell through the write barrier, a write of the same value is dropped
+*/
+static inline void CSET(unsigned char *cells, unsigned char i, unsigned char v)
+{
+	if (cells[i] == v)
+		return;
+	cells[i] = v;
+	cell_wrote(i, v);
+}
+
+/*
+Filter Clock
+Timer1 toggles the MAX7400 clock in CTC mode with OCR1A as TOP. Writing a
+TOP below the running TCNT1 lets the counter run through 65535 first,
+a long dropout of the filter clock. A TOP safely above TCNT1 is written at
+once (and cancels a staged one), the sweep never waits for a period. Only
+a TOP at or below the counter is staged and committed from the compare
+match ISR, right after the counter was cleared. The ISR is armed only
+while a value is pending, at small TOPs it would otherwise fire on every
+filter clock edge. OCF1A is set by every match, also while the ISR is off,
+so arming clears it first: the ISR then runs at the next match and not at
+once in the middle of a period.
+*/
+#define OCR1A_MARGIN 16 // timer counts that may pass during the direct write at /1
+
+static volatile unsigned int ocr1a_next;
+
+ISR(TIMER1_COMPA_vect)
+{
+	unsigned int top = ocr1a_next;
+
+	OCR1A = top;
+	if (TCNT1 > top) // already past the new TOP, restart the period instead of wrapping
+		TCNT1 = 0;
+	TIMSK1 &= ~(1 << OCIE1A); // one shot, filter_clock() arms it again
+}
+
+static inline void filter_clock(unsigned int top)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (top > OCR1A_MARGIN && TCNT1 < top - OCR1A_MARGIN)
+		{
+			OCR1A = top;			  // the counter reaches the new TOP in this period
+			TIMSK1 &= ~(1 << OCIE1A); // a staged value is older, drop it
+		}
+		else
+		{
+			ocr1a_next = top;		 // latest value wins if the ISR has not run yet
+			TIFR1 = (1 << OCF1A);	 // drop the flag of an earlier match, commit at the next one
+			TIMSK1 |= (1 << OCIE1A);
+		}
+	}
+}
+
+/*
+Per filterk factors, loaded when filterk changes, so the filter functions
+do one hardware multiply instead of a variable shift loop or a division.
+Exact for cel < 512, the callers pass a cell or the sum of two cells.
+*/
+typedef struct
+{
+	unsigned int lmul; // 1 << k
+	unsigned int rmul; // 256 >> k, the result is the product >> 8
+	unsigned int dmul; // ceil(65536 / (k + 1)), result is the product >> 16, 0 for k = 0
+} FilterScale;
+
+static const FilterScale filter_scales[16] PROGMEM = {
+	{1, 256, 0},
+	{2, 128, 32768},
+	{4, 64, 21846},
+	{8, 32, 16384},
+	{16, 16, 13108},
+	{32, 8, 10923},
+	{64, 4, 9363},
+	{128, 2, 8192},
+	{256, 1, 7282},
+	{512, 0, 6554},
+	{1024, 0, 5958},
+	{2048, 0, 5462},
+	{4096, 0, 5042},
+	{8192, 0, 4682},
+	{16384, 0, 4370},
+	{32768, 0, 4096},
+};
+
+static FilterScale filter_scale = {1, 256, 0}; // filterk starts at 0
+
+static void filter_scale_load(unsigned char k)
+{
+	filter_scale.lmul = pgm_read_word(&filter_scales[k & 15].lmul);
+	filter_scale.rmul = pgm_read_word(&filter_scales[k & 15].rmul);
+	filter_scale.dmul = pgm_read_word(&filter_scales[k & 15].dmul);
+}
+
 /*Filter Function: Shift Left */
 void leftsh(unsigned int cel)
 {
-	OCR1A = cel << filterk;
+	filter_clock(cel * filter_scale.lmul); // cel << filterk
 }
 /*Filter Function: Shift Right */
 void rightsh(unsigned int cel)
 {
-	OCR1A = cel >> filterk;
+	filter_clock(((unsigned long)cel * filter_scale.rmul) >> 8); // cel >> filterk
 }
 /*Filter Function: Multiply */
 void mult(unsigned int cel)
 {
-	OCR1A = cel * filterk;
+	filter_clock(cel * filterk);
 }
 /*Filter Function: Division */
 void divvv(unsigned int cel)
 {
-	OCR1A = cel / (filterk + 1);
+	if (filter_scale.dmul)
+		filter_clock(((unsigned long)cel * filter_scale.dmul) >> 16); // cel / (filterk + 1)
+	else
+		filter_clock(cel);
 }
 /*
 Pointer Function for Filter Assignments
@@ -156,451 +893,743 @@ Functions modify Clock Frequenz of Filter Max7400
 */
 void (*filtermod[])(unsigned int cel) = {leftsh, rightsh, mult, divvv};
 
+/*
+Hardware Profiles
+The filter clock (DDRB/TCCR1B/filterk) and the CD4066 routing (PORTD0-2)
+are described by PROGMEM tables and written only when the selected
+profile changes. Rewriting TCCR1B every pass glitches the filter clock.
+*/
+#define PROFILE_KEEP 0 // tccr1b/filterk field leaves the current value alone
+
+#define TIMER1_DIV1 ((1 << WGM12) | (1 << CS10))			  // no divider
+#define TIMER1_DIV8 ((1 << WGM12) | (1 << CS11))			  // divide by 8
+#define TIMER1_DIV64 ((1 << WGM12) | (1 << CS11) | (1 << CS10)) // divide by 64
+#define TIMER1_DIV256 ((1 << WGM12) | (1 << CS12))			  // 256
+
+typedef struct
+{
+	unsigned char on;	   // filter clock pin PB1 driven
+	unsigned char tccr1b;  // Timer1 clock select or PROFILE_KEEP
+	unsigned char filterk; // filtermod() factor or PROFILE_KEEP
+} FilterProfile;
+
+/* fhk = hardware >> 4 */
+static const FilterProfile filter_profiles[16] PROGMEM = {
+	{0, PROFILE_KEEP, PROFILE_KEEP}, // 0 filter off
+	{1, TIMER1_DIV1, 8},
+	{1, TIMER1_DIV1, 4},
+	{1, TIMER1_DIV1, 2},
+	{1, TIMER1_DIV1, PROFILE_KEEP},
+	{1, TIMER1_DIV8, 8},
+	{1, TIMER1_DIV8, 4},
+	{1, TIMER1_DIV8, 2},
+	{1, TIMER1_DIV8, PROFILE_KEEP},
+	{1, TIMER1_DIV64, 8},
+	{1, TIMER1_DIV64, 4},
+	{1, TIMER1_DIV64, 2},
+	{1, TIMER1_DIV64, PROFILE_KEEP},
+	{1, TIMER1_DIV256, 8},
+	{1, TIMER1_DIV256, 6},
+	{0, TIMER1_DIV256, 4}, // 15 always fell through to filter off
+};
+
+/* redrooms(): seven rooms, IP % 7 */
+static const FilterProfile filter_rooms[7] PROGMEM = {
+	{1, TIMER1_DIV1, 8},			  // blue
+	{1, TIMER1_DIV1, PROFILE_KEEP},   // purple
+	{1, TIMER1_DIV8, 8},			  // green
+	{1, TIMER1_DIV8, PROFILE_KEEP},   // orange
+	{1, TIMER1_DIV64, PROFILE_KEEP},  // white
+	{1, TIMER1_DIV256, PROFILE_KEEP}, // violet
+	{0, PROFILE_KEEP, PROFILE_KEEP},  // black
+};
+
+static unsigned char filter_on = 1, filter_tccr1b = TIMER1_DIV8; // shadows of DDRB1/TCCR1B, match the setup in main()
+static unsigned char filter_dirty;								 // someone else moved the filter, main() restores the knob profile
+
+static void filter_apply(const FilterProfile *p)
+{
+	unsigned char on = pgm_read_byte(&p->on);
+	unsigned char tccr = pgm_read_byte(&p->tccr1b);
+	unsigned char k = pgm_read_byte(&p->filterk);
+
+	if (tccr != PROFILE_KEEP && tccr != filter_tccr1b)
+	{
+		TCCR1B = tccr;
+		filter_tccr1b = tccr;
+	}
+	if (k != PROFILE_KEEP && k != filterk)
+	{
+		filterk = k;
+		filter_scale_load(k);
+	}
+	if (on != filter_on)
+	{
+		if (on)
+			sbi(DDRB, PORTB1); // Filter on
+		else
+			cbi(DDRB, PORTB1); // filter off
+		filter_on = on;
+	}
+}
+
+#define ROUTE_BITS ((1 << PORTD0) | (1 << PORTD1) | (1 << PORTD2))
+
+#define ROUTE_STATIC 0 // set once on profile change
+#define ROUTE_FOLLOW 1 // feedback follows bit 0 of the instruction pointer
+#define ROUTE_TOGGLE 2 // all three switches toggle
+
+typedef struct
+{
+	unsigned char clr; // PORTD bits cleared
+	unsigned char set; // PORTD bits set
+	unsigned char mod; // modulation run by route_modulate()
+} RouteProfile;
+
+/* hardk = hardware & 7 */
+static const RouteProfile route_profiles[8] PROGMEM = {
+	{(1 << PORTD2), 0, ROUTE_STATIC},					 // 0 no feedback
+	{0, (1 << PORTD2), ROUTE_STATIC},					 // 1 feedback
+	{(1 << PORTD1), (1 << PORTD0), ROUTE_STATIC},		 // 2 IC40106 to filter, pwm not
+	{(1 << PORTD0), (1 << PORTD1), ROUTE_STATIC},		 // 3 pwm to filter, IC40106 not
+	{0, ROUTE_BITS, ROUTE_STATIC},						 // 4 all to filter with feedback
+	{0, 0, ROUTE_FOLLOW},								 // 5 toggle feedback through the instruction pointer
+	{0, (1 << PORTD0) | (1 << PORTD1), ROUTE_STATIC}, // 6 IC40106 and pwm to filter
+	{0, 0, ROUTE_TOGGLE},								 // 7 toggle routing to filter and feedback
+};
+
+static unsigned char route_mod;
+
+static void route_apply(unsigned char k)
+{
+	unsigned char clr = pgm_read_byte(&route_profiles[k].clr);
+	unsigned char set = pgm_read_byte(&route_profiles[k].set);
+
+	route_mod = pgm_read_byte(&route_profiles[k].mod);
+	if (clr | set)
+		PORTD = (PORTD & ~clr) | set;
+}
+
+/*
+Modulated routing, called once per CPU step so the rate follows the left knob
+instead of the main loop speed
+*/
+static inline void route_modulate(unsigned char ip)
+{
+	switch (route_mod)
+	{
+	case ROUTE_FOLLOW:
+		if (ip & 0x01)
+			cbi(PORTD, PORTD2); // no feedback
+		else
+			sbi(PORTD, PORTD2); // feedback
+		break;
+	case ROUTE_TOGGLE:
+		PORTD ^= ROUTE_BITS;
+		break;
+	}
+}
+
 // first attempt - add in DATA POINTER= omem
 
 /* instructionsetfirst */
 
 /*Modify Filter Frequenz of Max7400 Filter*/
-unsigned char outff(unsigned char *cells, unsigned char IP)
+static unsigned char outff(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=(int)omem<<filterk;
-	(*filtermod[qqq])((int)cells[omem]);
-	return IP + insdir;
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
+	return IP + vm->insdir;
 }
 
-unsigned char outpp(unsigned char *cells, unsigned char IP)
+static unsigned char outpp(VMState *vm, unsigned char IP)
 {
-	OCR0A = omem;
-	return IP + insdir;
+	vm_play(vm, vm->omem);
+	return IP + vm->insdir;
 }
 
-unsigned char finc(unsigned char *cells, unsigned char IP)
+static unsigned char finc(VMState *vm, unsigned char IP)
 {
-	omem = SAFE_IDX(omem + 1); // safe wrapping
-	return IP + insdir;
+	vm->omem = SAFE_IDX(vm->omem + 1); // safe wrapping
+	return IP + vm->insdir;
 }
 
-unsigned char fdec(unsigned char *cells, unsigned char IP)
+static unsigned char fdec(VMState *vm, unsigned char IP)
 {
-	omem = SAFE_IDX(omem - 1); // safe wrapping
-	return IP + insdir;
+	vm->omem = SAFE_IDX(vm->omem - 1); // safe wrapping
+	return IP + vm->insdir;
 }
 
-unsigned char fincm(unsigned char *cells, unsigned char IP)
+static unsigned char fincm(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(omem)]++; // safe index
-	return IP + insdir;
+	CSET(vm->cells, vm->omem, vm->cells[SAFE_IDX(vm->omem)] + 1); // safe index
+	return IP + vm->insdir;
 }
 
-unsigned char fdecm(unsigned char *cells, unsigned char IP)
+static unsigned char fdecm(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(omem)]--; // safe index
-	return IP + insdir;
+	CSET(vm->cells, vm->omem, vm->cells[SAFE_IDX(vm->omem)] - 1); // safe index
+	return IP + vm->insdir;
 }
 
 /* get omem from Output*/
-unsigned char fin1(unsigned char *cells, unsigned char IP)
+static unsigned char fin1(VMState *vm, unsigned char IP)
 {
-	omem = adcread(3); // get output signal
-	return IP + insdir;
+	vm->omem = adcread(3); // get output signal
+	return IP + vm->insdir;
 }
 
 /*get omem from Poti 3 */
-unsigned char fin2(unsigned char *cells, unsigned char IP)
+static unsigned char fin2(VMState *vm, unsigned char IP)
 {
-	omem = adcread(2);
-	return IP + insdir;
+	vm->omem = adcread(2);
+	return IP + vm->insdir;
 }
 /*get IP from Poti 3*/
-unsigned char fin3(unsigned char *cells, unsigned char IP)
+static unsigned char fin3(VMState *vm, unsigned char IP)
 {
 	IP = adcread(2);
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 /**/
-unsigned char fin4(unsigned char *cells, unsigned char IP)
+static unsigned char fin4(VMState *vm, unsigned char IP)
 {
-	cells[omem] = adcread(3); // get output signal
-	return IP + insdir;
+	CSET(vm->cells, vm->omem, adcread(3)); // get output signal
+	return IP + vm->insdir;
 }
 
-unsigned char outf(unsigned char *cells, unsigned char IP)
+static unsigned char outf(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=(int)cells[omem]<<filterk;
-	(*filtermod[qqq])((int)cells[omem]);
-	return IP + insdir;
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
+	return IP + vm->insdir;
 }
 
-unsigned char outp(unsigned char *cells, unsigned char IP)
+static unsigned char outp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[omem];
-	return IP + insdir;
+	vm_play(vm, vm->cells[vm->omem]);
+	return IP + vm->insdir;
 }
 
-unsigned char plus(unsigned char *cells, unsigned char IP)
+static unsigned char plus(VMState *vm, unsigned char IP)
 {
-	cells[IP] += 1;
-	return IP + insdir;
+	CSET(vm->cells, IP, vm->cells[IP] + 1);
+	return IP + vm->insdir;
 }
 
-unsigned char minus(unsigned char *cells, unsigned char IP)
+static unsigned char minus(VMState *vm, unsigned char IP)
 {
-	cells[IP] -= 1;
-	return IP + insdir;
+	CSET(vm->cells, IP, vm->cells[IP] - 1);
+	return IP + vm->insdir;
 }
 
-unsigned char bitshift1(unsigned char *cells, unsigned char IP)
+static unsigned char bitshift1(VMState *vm, unsigned char IP)
 {
-	cells[IP] = cells[IP] << 1;
-	return IP + insdir;
+	CSET(vm->cells, IP, vm->cells[IP] << 1);
+	return IP + vm->insdir;
 }
 
-unsigned char bitshift2(unsigned char *cells, unsigned char IP)
+static unsigned char bitshift2(VMState *vm, unsigned char IP)
 {
-	cells[IP] = cells[IP] << 2;
-	return IP + insdir;
+	CSET(vm->cells, IP, vm->cells[IP] << 2);
+	return IP + vm->insdir;
 }
 
-unsigned char bitshift3(unsigned char *cells, unsigned char IP)
+static unsigned char bitshift3(VMState *vm, unsigned char IP)
 {
-	cells[IP] = cells[IP] << 3;
-	return IP + insdir;
+	CSET(vm->cells, IP, vm->cells[IP] << 3);
+	return IP + vm->insdir;
 }
 
-unsigned char branch(unsigned char *cells, unsigned char IP)
+static unsigned char branch(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + 1)] == 0) // safe index
-		IP = cells[omem];
-	return IP + insdir;
+	if (vm->cells[SAFE_IDX(IP + 1)] == 0) // safe index
+		IP = vm->cells[vm->omem];
+	return IP + vm->insdir;
 }
 
-unsigned char jump(unsigned char *cells, unsigned char IP)
+static unsigned char jump(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + 1)] < 128)				   // safe index
-		return SAFE_IDX(IP + cells[SAFE_IDX(IP + 1)]); // safe wrapping
+	if (vm->cells[SAFE_IDX(IP + 1)] < 128)				   // safe index
+		return SAFE_IDX(IP + vm->cells[SAFE_IDX(IP + 1)]); // safe wrapping
 	else
-		return IP + insdir;
+		return IP + vm->insdir;
 }
 
-unsigned char infect(unsigned char *cells, unsigned char IP)
+static unsigned char infect(VMState *vm, unsigned char IP)
 {
 	int x = IP - 1;
 	if (x < 0)
 		x = MAX_SAM;
-	if (cells[x] < 128)
-		cells[SAFE_IDX(IP + 1)] = cells[IP]; // safe index
-	return IP + insdir;
+	if (vm->cells[x] < 128)
+		CSET(vm->cells, IP + 1, vm->cells[IP]); // safe index
+	return IP + vm->insdir;
 }
-unsigned char store(unsigned char *cells, unsigned char IP)
+static unsigned char store(VMState *vm, unsigned char IP)
 {
 	// Safe indirect addressing: wrap both indices
-	unsigned char idx_indirect = SAFE_IDX(cells[SAFE_IDX(IP + 1)]);
-	cells[IP] = cells[idx_indirect];
-	return IP + insdir;
+	unsigned char idx_indirect = SAFE_IDX(vm->cells[SAFE_IDX(IP + 1)]);
+	CSET(vm->cells, IP, vm->cells[idx_indirect]);
+	return IP + vm->insdir;
 }
 
-unsigned char writeknob(unsigned char *cells, unsigned char IP)
+static unsigned char writeknob(VMState *vm, unsigned char IP)
 {
-	cells[IP] = adcread(2);
-	return IP + insdir;
+	CSET(vm->cells, IP, adcread(2));
+	return IP + vm->insdir;
 }
 
-unsigned char writesamp(unsigned char *cells, unsigned char IP)
+static unsigned char writesamp(VMState *vm, unsigned char IP)
 {
-	cells[IP] = adcread(3); // get output signal
-	return IP + insdir;
+	CSET(vm->cells, IP, adcread(3)); // get output signal
+	return IP + vm->insdir;
 }
 
-unsigned char skip(unsigned char *cells, unsigned char IP)
+static unsigned char skip(VMState *vm, unsigned char IP)
 {
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
 // Sets direction
-unsigned char direction(unsigned char *cells, unsigned char IP)
+static unsigned char direction(VMState *vm, unsigned char IP)
 {
-	if (dir < 0)
-		dir = 1;
+	if (vm->dir < 0)
+		vm->dir = 1;
 	else
-		dir = -1;
-	return IP + insdir;
+		vm->dir = -1;
+	return IP + vm->insdir;
 }
 
 // do nothing
-unsigned char die(unsigned char *cells, unsigned char IP)
+static unsigned char die(VMState *vm, unsigned char IP)
 {
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
-/* instructionsetplague */
-/* Plague Algorithms*/
-
-unsigned char ploutf(unsigned char *cells, unsigned char IP)
+#if SUPERINSN
+/*
+Fused sequences, run with insdir = dir = 1 only. Each does what its
+instructions do one after the other; when a write changed the opcode of a
+later cell of the sequence the step ends before it, the next step decodes
+that cell again.
+*/
+static unsigned char super_run(unsigned char sup, VMState *vm, unsigned char IP)
 {
-	//  OCR1A=((int)cells[IP+1]+(int)cells[IP-1])<<filterk;
-	(*filtermod[qqq])((int)cells[omem]);
+	super_runs++;
+	switch (sup)
+	{
+	case SUPER_FINC_FINCM:
+		vm->omem++;
+		CSET(vm->cells, vm->omem, vm->cells[vm->omem] + 1);
+		return IP + 2;
+	case SUPER_FINC_FINCM_OUTP:
+		vm->omem++;
+		CSET(vm->cells, vm->omem, vm->cells[vm->omem] + 1);
+		IP += 2;
+		if ((opcache[IP] & OP_MASK) != OP_OUTP)
+			return IP;
+		vm_play(vm, vm->cells[vm->omem]);
+		return IP + 1;
+	case SUPER_FINCM_OUTP:
+		CSET(vm->cells, vm->omem, vm->cells[vm->omem] + 1);
+		IP += 1;
+		if ((opcache[IP] & OP_MASK) != OP_OUTP)
+			return IP;
+		vm_play(vm, vm->cells[vm->omem]);
+		return IP + 1;
+	case SUPER_PLUS_SHL:
+		CSET(vm->cells, IP, vm->cells[IP] + 1);
+		IP += 1;
+		CSET(vm->cells, IP, vm->cells[IP] << 1);
+		return IP + 1;
+	default: // SUPER_PLUS_SHL_JUMP
+		CSET(vm->cells, IP, vm->cells[IP] + 1);
+		IP += 1;
+		CSET(vm->cells, IP, vm->cells[IP] << 1);
+		IP += 1;
+		if (vm->cells[SAFE_IDX(IP + 1)] < 128)
+			return SAFE_IDX(IP + vm->cells[SAFE_IDX(IP + 1)]);
+		return IP + 1;
+	}
+}
+#endif
 
-	return IP + insdir;
+/* instructionsetplague */
+/* Plague Algorithms*/
+
+static unsigned char ploutf(VMState *vm, unsigned char IP)
+{
+	//  OCR1A=((int)cells[IP+1]+(int)cells[IP-1])<<filterk;
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
+
+	return IP + vm->insdir;
 }
 
-unsigned char ploutp(unsigned char *cells, unsigned char IP)
+static unsigned char ploutp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[SAFE_IDX(IP + 1)] + cells[SAFE_IDX(IP - 1)];
-	return IP + insdir;
+	vm_play(vm, vm->cells[SAFE_IDX(IP + 1)] + vm->cells[SAFE_IDX(IP - 1)]);
+	return IP + vm->insdir;
 }
 
-unsigned char plenclose(unsigned char *cells, unsigned char IP)
+static unsigned char plenclose(VMState *vm, unsigned char IP)
 {
-	cells[IP] = 255;
-	cells[SAFE_IDX(IP + 1)] = 255; // safe index
+	CSET(vm->cells, IP, 255);
+	CSET(vm->cells, IP + 1, 255); // safe index
 	return IP + 2;
 }
 
-unsigned char plinfect(unsigned char *cells, unsigned char IP)
+static unsigned char plinfect(VMState *vm, unsigned char IP)
 {
 
-	if (cells[IP] < 128)
+	if (vm->cells[IP] < 128)
 	{
-		cells[SAFE_IDX(IP + 1)] = cells[SAFE_IDX(IP)];
-		cells[SAFE_IDX(IP - 1)] = cells[SAFE_IDX(IP)];
+		CSET(vm->cells, IP + 1, vm->cells[SAFE_IDX(IP)]);
+		CSET(vm->cells, IP - 1, vm->cells[SAFE_IDX(IP)]);
 	}
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
-unsigned char pldie(unsigned char *cells, unsigned char IP)
+static unsigned char pldie(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(IP - 1)] = 0;
-	cells[SAFE_IDX(IP + 1)] = 0;
-	return IP + insdir;
+	CSET(vm->cells, IP - 1, 0);
+	CSET(vm->cells, IP + 1, 0);
+	return IP + vm->insdir;
 }
 
-unsigned char plwalk(unsigned char *cells, unsigned char IP)
+static unsigned char plwalk(VMState *vm, unsigned char IP)
 {
 	// changing direction
-	if (dir < 0 && (cells[IP] % 0x03) == 1)
-		dir = 1;
-	else if (dir > 1 && (cells[IP] % 0x03) == 0)
-		dir = -1;
+	if (vm->dir < 0 && (vm->cells[IP] % 0x03) == 1)
+		vm->dir = 1;
+	else if (vm->dir > 1 && (vm->cells[IP] % 0x03) == 0)
+		vm->dir = -1;
 	else
 		// changing pace - correct operator precedence
-		insdir = ((int)dir * cells[IP]) >> 4; // safe precedence
+		vm->insdir = ((int)vm->dir * vm->cells[IP]) >> 4; // safe precedence
 
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
 /* instructionsetbf */
 /* instructionsetplague */
 /* Brainfuck*/
 
-unsigned char bfinc(unsigned char *cells, unsigned char IP)
+#if BF_LINKED
+#define BF_RUN(IP) (opcache[IP] >> 3) // > < + - cells folded into this one
+#else
+#define BF_RUN(IP) 1
+#endif
+
+static unsigned char bfinc(VMState *vm, unsigned char IP)
 {
-	omem++;
-	return ++IP;
+	unsigned char n = BF_RUN(IP);
+	vm->omem += n;
+	return IP + n;
 }
 
-unsigned char bfdec(unsigned char *cells, unsigned char IP)
+static unsigned char bfdec(VMState *vm, unsigned char IP)
 {
-	omem--;
-	return ++IP;
+	unsigned char n = BF_RUN(IP);
+	vm->omem -= n;
+	return IP + n;
 }
 
-unsigned char bfincm(unsigned char *cells, unsigned char IP)
+static unsigned char bfincm(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(omem)]++; // safe index
-	return ++IP;
+	unsigned char n = BF_RUN(IP), d = vm->omem - IP;
+	if (d && d < n)
+		n = d; // the run writes into itself, the cells from omem on change
+	CSET(vm->cells, vm->omem, vm->cells[SAFE_IDX(vm->omem)] + n); // safe index
+	return IP + n;
 }
 
-unsigned char bfdecm(unsigned char *cells, unsigned char IP)
+static unsigned char bfdecm(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(omem)]--; // safe index
-	return ++IP;
+	unsigned char n = BF_RUN(IP), d = vm->omem - IP;
+	if (d && d < n)
+		n = d; // the run writes into itself, the cells from omem on change
+	CSET(vm->cells, vm->omem, vm->cells[SAFE_IDX(vm->omem)] - n); // safe index
+	return IP + n;
 }
 
-unsigned char bfoutf(unsigned char *cells, unsigned char IP)
+static unsigned char bfoutf(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=(int)cells[omem]<<filterk;
-	(*filtermod[qqq])((int)cells[omem]);
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
 	return ++IP;
 }
 
-unsigned char bfoutp(unsigned char *cells, unsigned char IP)
+static unsigned char bfoutp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[omem];
+	vm_play(vm, vm->cells[vm->omem]);
 	return ++IP;
 }
 
-unsigned char bfin(unsigned char *cells, unsigned char IP)
+static unsigned char bfin(VMState *vm, unsigned char IP)
 {
-	cells[omem] = adcread(3); // get output signal
+	CSET(vm->cells, vm->omem, adcread(3)); // get output signal
+	return ++IP;
+}
+
+#if BF_LINKED
+/*
+[ jumps past its ] when cells[omem] is 0, ] jumps back behind its [ when it
+is not, an unmatched bracket does nothing
+*/
+static unsigned char bfbrac1(VMState *vm, unsigned char IP)
+{
+	unsigned char s;
+	if (bf_stale)
+		bf_relink();
+	s = opcache[IP] & BF_NOLINK;
+	if (s != BF_NOLINK && vm->cells[vm->omem] == 0)
+		return (IP ^ bf_link[s]) + 1;
 	return ++IP;
 }
 
-unsigned char bfbrac1(unsigned char *cells, unsigned char IP)
+static unsigned char bfbrac2(VMState *vm, unsigned char IP)
+{
+	unsigned char s;
+	if (bf_stale)
+		bf_relink();
+	s = opcache[IP] & BF_NOLINK;
+	if (s != BF_NOLINK && vm->cells[vm->omem] != 0)
+		return (IP ^ bf_link[s]) + 1;
+	return ++IP;
+}
+#else
+static unsigned char bfbrac1(VMState *vm, unsigned char IP)
 {
-	cycle++;
-	if (cycle >= 20)
-		cycle = 0;
-	ostack[cycle] = IP;
+	vm->cycle++;
+	if (vm->cycle >= 20)
+		vm->cycle = 0;
+	vm->ostack[vm->cycle] = IP;
 	return ++IP;
 }
 
-unsigned char bfbrac2(unsigned char *cells, unsigned char IP)
+static unsigned char bfbrac2(VMState *vm, unsigned char IP)
 {
 	int i = 0;
-	if (cells[omem] != 0)
-		i = ostack[cycle] - 1;
-	cycle--;
-	if (cycle < 0)
-		cycle = 19;
+	if (vm->cells[vm->omem] != 0)
+		i = vm->ostack[vm->cycle] - 1;
+	if (vm->cycle == 0)
+		vm->cycle = 19; // cycle is unsigned, it used to run off the stack
+	else
+		vm->cycle--;
 	return i;
 }
+#endif
 
 /* instructionsetSIR */
 // SIR: inc if , die if, recover if, getinfected if
 
-unsigned char SIRoutf(unsigned char *cells, unsigned char IP)
+static unsigned char SIRoutf(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=((int)cells[(IP+1)]+(int)cells[IP-1])<<filterk;
-	(*filtermod[qqq])((int)cells[SAFE_IDX(IP + 1)] + (int)cells[SAFE_IDX(IP - 1)]); // safe indices
+	(*filtermod[qqq])((int)vm->cells[SAFE_IDX(IP + 1)] + (int)vm->cells[SAFE_IDX(IP - 1)]); // safe indices
 
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
-unsigned char SIRoutp(unsigned char *cells, unsigned char IP)
+static unsigned char SIRoutp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[SAFE_IDX(IP + 1)] + cells[SAFE_IDX(IP - 1)]; // safe indices
-	return IP + insdir;
+	vm_play(vm, vm->cells[SAFE_IDX(IP + 1)] + vm->cells[SAFE_IDX(IP - 1)]); // safe indices
+	return IP + vm->insdir;
 }
 
-unsigned char SIRincif(unsigned char *cells, unsigned char IP)
+static unsigned char SIRincif(VMState *vm, unsigned char IP)
 {
-	if ((cells[SAFE_IDX(IP + 1)] > 0 && cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
-		cells[IP]++;
-	return IP + insdir;
+	if ((vm->cells[SAFE_IDX(IP + 1)] > 0 && vm->cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
+		CSET(vm->cells, IP, vm->cells[IP] + 1);
+	return IP + vm->insdir;
 }
 
-unsigned char SIRdieif(unsigned char *cells, unsigned char IP)
+static unsigned char SIRdieif(VMState *vm, unsigned char IP)
 {
 
-	if ((cells[SAFE_IDX(IP + 1)] > 0 && cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
+	if ((vm->cells[SAFE_IDX(IP + 1)] > 0 && vm->cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
 	{
-		if (rand() % 10 < 4)
-			cells[IP] = dead;
+		if (prng8() < PRNG_P10(4)) // 4 in 10
+			CSET(vm->cells, IP, dead);
 	}
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
-unsigned char SIRrecif(unsigned char *cells, unsigned char IP)
+static unsigned char SIRrecif(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + 1)] >= 128) // safe index
-		cells[IP] = recovered;
-	return IP + insdir;
+	if (vm->cells[SAFE_IDX(IP + 1)] >= 128) // safe index
+		CSET(vm->cells, IP, recovered);
+	return IP + vm->insdir;
 }
 
-unsigned char SIRinfif(unsigned char *cells, unsigned char IP)
+static unsigned char SIRinfif(VMState *vm, unsigned char IP)
 {
 
-	if (cells[SAFE_IDX(IP - 1)] == 0)
+	if (vm->cells[SAFE_IDX(IP - 1)] == 0)
 	{
 
-		if ((cells[SAFE_IDX(IP - 1)] > 0 && cells[SAFE_IDX(IP - 1)] < 128) ||
-			(cells[SAFE_IDX(IP + 1)] > 0 && cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
+		if ((vm->cells[SAFE_IDX(IP - 1)] > 0 && vm->cells[SAFE_IDX(IP - 1)] < 128) ||
+			(vm->cells[SAFE_IDX(IP + 1)] > 0 && vm->cells[SAFE_IDX(IP + 1)] < 128)) // safe indices
 		{
-			if (rand() % 10 < 4)
-				cells[IP] = 1;
+			if (prng8() < PRNG_P10(4)) // 4 in 10
+				CSET(vm->cells, IP, 1);
 		}
 	}
-	return IP + insdir;
+	return IP + vm->insdir;
 }
 
 /* instructionsetredcode */
 // red code
 
-unsigned char rdmov(unsigned char *cells, unsigned char IP)
+/*
+Operands of the instruction being run, set by rd_fetch(): rd_a / rd_b are
+IP + A-field / IP + B-field, except the jump targets of jmz, jmg and djz and
+the played values of outf and outp, which are the fields themselves
+*/
+static unsigned char rd_a, rd_b;
+
+#if REDCODE_TASKS > 1
+#define RD_SPL 1 // rd_event: start a process at rd_a
+#define RD_DAT 2 // rd_event: end the running process
+static unsigned char rd_event;
+#endif
+
+/*
+Resolve the operands of the instruction at IP, opcode op
+*/
+static inline void rd_fetch(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if REDCODE_CACHE
+	RedRecord *r = &rd_cache[IP & (REDCODE_CACHE - 1)];
+	if (r->ip != IP)
+	{
+		r->ip = IP;
+		r->a = vm->cells[SAFE_IDX(IP + 1)];
+		r->b = vm->cells[SAFE_IDX(IP + 2)];
+		if (!((op >= 4 && op <= 6) || op == 9))
+			r->a += IP;
+		if (op != 10)
+			r->b += IP;
+		rd_decodes++;
+	}
+	rd_a = r->a;
+	rd_b = r->b;
+#else
+	rd_a = vm->cells[SAFE_IDX(IP + 1)];
+	rd_b = vm->cells[SAFE_IDX(IP + 2)];
+	if (!((op >= 4 && op <= 6) || op == 9))
+		rd_a += IP;
+	if (op != 10)
+		rd_b += IP;
+#endif
+}
+
+/*
+Pick the process for the next step, nip is where the one just run goes on.
+One instruction per step in total, however many processes there are.
+*/
+static inline unsigned char rd_next(VMState *vm, unsigned char nip)
+{
+#if REDCODE_TASKS > 1
+	unsigned char e = rd_event;
+	rd_event = 0;
+	if (e != RD_DAT || vm->rd_ntask == 0) // the last process never ends, the core keeps playing
+		vm->rd_task[(vm->rd_head + vm->rd_ntask++) & (REDCODE_TASKS - 1)] = nip;
+	if (e == RD_SPL && vm->rd_ntask < REDCODE_TASKS)
+		vm->rd_task[(vm->rd_head + vm->rd_ntask++) & (REDCODE_TASKS - 1)] = rd_a;
+	nip = vm->rd_task[vm->rd_head];
+	vm->rd_head = (vm->rd_head + 1) & (REDCODE_TASKS - 1);
+	vm->rd_ntask--;
+#endif
+	return nip;
+}
+
+static unsigned char rdmov(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(IP + cells[IP + 2])] = cells[SAFE_IDX(IP + cells[IP + 1])];
+	CSET(vm->cells, rd_b, vm->cells[rd_a]);
 	return IP += 3;
 }
 
-unsigned char rdadd(unsigned char *cells, unsigned char IP)
+static unsigned char rdadd(VMState *vm, unsigned char IP)
 {
-	unsigned char idx_dst = SAFE_IDX(IP + cells[IP + 2]);
-	unsigned char idx_src = SAFE_IDX(IP + cells[IP + 1]);
-	cells[idx_dst] = cells[idx_dst] + cells[idx_src];
+	CSET(vm->cells, rd_b, vm->cells[rd_b] + vm->cells[rd_a]);
 	return IP += 3;
 }
 
-unsigned char rdsub(unsigned char *cells, unsigned char IP)
+static unsigned char rdsub(VMState *vm, unsigned char IP)
 {
-	unsigned char idx_dst = SAFE_IDX(IP + cells[IP + 2]);
-	unsigned char idx_src = SAFE_IDX(IP + cells[IP + 1]);
-	cells[idx_dst] = cells[idx_dst] - cells[idx_src];
+	CSET(vm->cells, rd_b, vm->cells[rd_b] - vm->cells[rd_a]);
 	return IP += 3;
 }
 
-unsigned char rdjmp(unsigned char *cells, unsigned char IP)
+static unsigned char rdjmp(VMState *vm, unsigned char IP)
 {
-	IP = SAFE_IDX(IP + cells[SAFE_IDX(IP + 1)]); // safe wrapping
-	return IP;
+	return rd_a; // IP + A-field
 }
 
-unsigned char rdjmz(unsigned char *cells, unsigned char IP)
+static unsigned char rdjmz(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + cells[IP + 2])] == 0)
-		IP = SAFE_IDX(cells[SAFE_IDX(IP + 1)]); // safe index wrapping
+	if (vm->cells[rd_b] == 0)
+		IP = rd_a;
 	else
 		IP += 3;
 	return IP;
 }
 
-unsigned char rdjmg(unsigned char *cells, unsigned char IP)
+/*
+Was a jump on cells[] >= 0, always true for unsigned cells. With several
+processes it is SPL: start a process at the A-field, go on at IP + 3.
+*/
+static unsigned char rdjmg(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + cells[IP + 2])] >= 0)
-		IP = SAFE_IDX(cells[SAFE_IDX(IP + 1)]); // safe index wrapping
-	else
-		IP += 3;
-	return IP;
+#if REDCODE_TASKS > 1
+	rd_event = RD_SPL;
+	return IP += 3;
+#else
+	return rd_a;
+#endif
 }
 
-unsigned char rddjz(unsigned char *cells, unsigned char IP)
+static unsigned char rddjz(VMState *vm, unsigned char IP)
 {
-	unsigned char x;
-	x = SAFE_IDX(IP + cells[IP + 2]);
-	cells[x] = cells[x] - 1;
-	if (cells[x] == 0)
-		IP = SAFE_IDX(cells[SAFE_IDX(IP + 1)]); // safe index wrapping
+	CSET(vm->cells, rd_b, vm->cells[rd_b] - 1);
+	if (vm->cells[rd_b] == 0)
+		IP = (rd_b == SAFE_IDX(IP + 1)) ? 0 : rd_a; // the A-field itself just became 0
 	else
 		IP += 3;
 	return IP;
 }
 
-unsigned char rddat(unsigned char *cells, unsigned char IP)
+static unsigned char rddat(VMState *vm, unsigned char IP)
 {
+#if REDCODE_TASKS > 1
+	rd_event = RD_DAT; // ends the process
+#endif
 	IP += 3;
 	return IP;
 }
 
-unsigned char rdcmp(unsigned char *cells, unsigned char IP)
+static unsigned char rdcmp(VMState *vm, unsigned char IP)
 {
-	if (cells[SAFE_IDX(IP + cells[IP + 2])] != cells[SAFE_IDX(IP + cells[IP + 1])])
+	if (vm->cells[rd_b] != vm->cells[rd_a])
 		IP += 6;
 	else
 		IP += 3;
 	return IP;
 }
 
-unsigned char rdoutf(unsigned char *cells, unsigned char IP)
+static unsigned char rdoutf(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=(int)cells[(IP+1)]<<filterk;
-	(*filtermod[qqq])((int)cells[SAFE_IDX(IP + 1)]);
+	(*filtermod[qqq])((int)rd_a);
 
 	IP += 3;
 	return IP;
 }
 
-unsigned char rdoutp(unsigned char *cells, unsigned char IP)
+static unsigned char rdoutp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[SAFE_IDX(IP + 2)];
+	vm_play(vm, rd_b);
 	IP += 3;
 	return IP;
 }
@@ -609,161 +1638,112 @@ unsigned char rdoutp(unsigned char *cells, unsigned char IP)
 
 // BIOTA!
 
-unsigned char btempty(unsigned char *cells, unsigned char IP)
-{
-	// turn around
-	if (btdir == 0)
-		btdir = 1;
-	else if (btdir == 1)
-		btdir = 0;
-	else if (btdir == 2)
-		btdir = 3;
-	else if (btdir == 3)
-		btdir = 2;
+/*
+Biota Directions
+0 right, 1 left, 2 down, 3 up on the 16x16 cell space (omem / IP wrap as
+8 bit). A move is one load from bt_delta[] and an 8-bit add. The turns are
+permutations of the direction: d ^ BT_REVERSE walks back, d ^ BT_TURN
+turns onto the other axis, d ^ BT_UNTURN onto the other axis backwards.
+*/
+#define BT_REVERSE 1
+#define BT_TURN 2
+#define BT_UNTURN 3
+#define BT_SCAN 20 // longest btg() walk
+
+static const signed char bt_delta[4] PROGMEM = {1, -1, CELLLEN, -CELLLEN};
+
+/*
+omem / IP step for direction d
+*/
+static inline unsigned char bt_step(unsigned char d)
+{
+	return pgm_read_byte(&bt_delta[d]);
+}
+
+/*
+The instruction pointer turns around
+*/
+static inline void bt_reverse(VMState *vm)
+{
+	vm->btdir ^= BT_REVERSE;
+}
+
+static unsigned char btempty(VMState *vm, unsigned char IP)
+{
+	bt_reverse(vm); // turn around
 	return IP;
 }
 
-unsigned char btoutf(unsigned char *cells, unsigned char IP)
+static unsigned char btoutf(VMState *vm, unsigned char IP)
 {
 	//  OCR1A=(int)cells[omem]<<filterk;
-	(*filtermod[qqq])((int)cells[omem]);
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
 
 	return IP;
 }
 
-unsigned char btoutp(unsigned char *cells, unsigned char IP)
+static unsigned char btoutp(VMState *vm, unsigned char IP)
 {
-	OCR0A = cells[omem];
+	vm_play(vm, vm->cells[vm->omem]);
 	return IP;
 }
 
-unsigned char btstraight(unsigned char *cells, unsigned char IP)
-{
-	if (dcdir == 0)
-		omem = SAFE_IDX(omem + 1);
-	else if (dcdir == 1)
-		omem = SAFE_IDX(omem - 1);
-	else if (dcdir == 2)
-		omem = SAFE_IDX(omem + 16);
-	else if (dcdir == 3)
-		omem = SAFE_IDX(omem - 16);
-
-	if (cells[omem] == 0)
-	{ // change dir
-		if (btdir == 0)
-			btdir = 1;
-		else if (btdir == 1)
-			btdir = 0;
-		else if (btdir == 2)
-			btdir = 3;
-		else if (btdir == 3)
-			btdir = 2;
-	}
+static unsigned char btstraight(VMState *vm, unsigned char IP)
+{
+	vm->omem += bt_step(vm->dcdir);
+	if (vm->cells[vm->omem] == 0)
+		bt_reverse(vm); // change dir
 	return IP;
 }
 
-unsigned char btbackup(unsigned char *cells, unsigned char IP)
+static unsigned char btbackup(VMState *vm, unsigned char IP)
 {
-	if (dcdir == 0)
-		omem = SAFE_IDX(omem - 1);
-	else if (dcdir == 1)
-		omem = SAFE_IDX(omem + 1);
-	else if (dcdir == 2)
-		omem = SAFE_IDX(omem - 16);
-	else if (dcdir == 3)
-		omem = SAFE_IDX(omem + 16);
-	if (cells[omem] == 0)
-	{
-		if (btdir == 0)
-			btdir = 1;
-		else if (btdir == 1)
-			btdir = 0;
-		else if (btdir == 2)
-			btdir = 3;
-		else if (btdir == 3)
-			btdir = 2;
-	}
+	vm->omem += bt_step(vm->dcdir ^ BT_REVERSE);
+	if (vm->cells[vm->omem] == 0)
+		bt_reverse(vm);
 	return IP;
 }
 
-unsigned char btturn(unsigned char *cells, unsigned char IP)
+static unsigned char btturn(VMState *vm, unsigned char IP)
 {
-	if (dcdir == 0)
-		omem = SAFE_IDX(omem + 16);
-	else if (dcdir == 1)
-		omem = SAFE_IDX(omem - 16);
-	else if (dcdir == 2)
-		omem = SAFE_IDX(omem + 1);
-	else if (dcdir == 3)
-		omem = SAFE_IDX(omem - 1);
+	vm->omem += bt_step(vm->dcdir ^ BT_TURN);
 	return IP;
 }
 
-unsigned char btunturn(unsigned char *cells, unsigned char IP)
+static unsigned char btunturn(VMState *vm, unsigned char IP)
 {
-	if (dcdir == 0)
-		omem = SAFE_IDX(omem - 16);
-	else if (dcdir == 1)
-		omem = SAFE_IDX(omem + 16);
-	else if (dcdir == 2)
-		omem = SAFE_IDX(omem - 1);
-	else if (dcdir == 3)
-		omem = SAFE_IDX(omem + 1);
+	vm->omem += bt_step(vm->dcdir ^ BT_UNTURN);
 	return IP;
 }
 
-unsigned char btg(unsigned char *cells, unsigned char IP)
+/*
+Walk to the next zero cell along dcdir, at most BT_SCAN steps. The step is
+loaded once, the walk is a load, a compare and an 8-bit add per cell.
+*/
+static unsigned char btg(VMState *vm, unsigned char IP)
 {
-	unsigned char x = 0;
-	// Safe loop with omem bounds checking to prevent wrap-around and infinite loops
-	while (x < 20 && cells[omem] != 0)
-	{
-		if (dcdir == 0)
-			omem = SAFE_IDX(omem + 1);
-		else if (dcdir == 1)
-			omem = SAFE_IDX(omem - 1);
-		else if (dcdir == 2)
-			omem = SAFE_IDX(omem + 16);
-		else if (dcdir == 3)
-			omem = SAFE_IDX(omem - 16);
-		x++;
-	}
+	unsigned char x = BT_SCAN, d = bt_step(vm->dcdir), m = vm->omem;
+	while (vm->cells[m] != 0 && x--)
+		m += d;
+	vm->omem = m;
 	return IP;
 }
 
-unsigned char btclear(unsigned char *cells, unsigned char IP)
+static unsigned char btclear(VMState *vm, unsigned char IP)
 {
-	if (cells[omem] == 0)
-	{
-		if (btdir == 0)
-			btdir = 1;
-		else if (btdir == 1)
-			btdir = 0;
-		else if (btdir == 2)
-			btdir = 3;
-		else if (btdir == 3)
-			btdir = 2;
-	}
+	if (vm->cells[vm->omem] == 0)
+		bt_reverse(vm);
 	else
-		cells[omem] = 0;
+		CSET(vm->cells, vm->omem, 0);
 	return IP;
 }
 
-unsigned char btdup(unsigned char *cells, unsigned char IP)
+static unsigned char btdup(VMState *vm, unsigned char IP)
 {
-	if (cells[omem] == 0 || cells[SAFE_IDX(omem - 1)] != 0) // safe index
-	{
-		if (btdir == 0)
-			btdir = 1;
-		else if (btdir == 1)
-			btdir = 0;
-		else if (btdir == 2)
-			btdir = 3;
-		else if (btdir == 3)
-			btdir = 2;
-	}
+	if (vm->cells[vm->omem] == 0 || vm->cells[SAFE_IDX(vm->omem - 1)] != 0) // safe index
+		bt_reverse(vm);
 	else
-		cells[SAFE_IDX(omem - 1)] = cells[omem]; // safe index
+		CSET(vm->cells, vm->omem - 1, vm->cells[vm->omem]); // safe index
 	return IP;
 }
 
@@ -771,170 +1751,266 @@ unsigned char btdup(unsigned char *cells, unsigned char IP)
 
 // 1- the plague within (12 midnight) - all the cells infect
 
-unsigned char redplague(unsigned char *cells, unsigned char IP)
+static unsigned char redplague(VMState *vm, unsigned char IP)
 {
-	if (clock == 12)
+	if (vm->clock == 12)
 	{
-		clock = 12;
-		cells[SAFE_IDX(IP + 1)] = cells[IP]; // safe index
+		vm->clock = 12;
+		CSET(vm->cells, IP + 1, vm->cells[IP]); // safe index
 		if (IP == 255)
-			clock = 13;
+			vm->clock = 13;
 		return IP + 1;
 	}
 	else
-		return IP + insdir;
+		return IP + vm->insdir;
 }
 
 // 3- death - one by one fall dead
-unsigned char reddeath(unsigned char *cells, unsigned char IP)
+static unsigned char reddeath(VMState *vm, unsigned char IP)
 {
-	if (clock == 13)
+	if (vm->clock == 13)
 	{
-		clock = 13;
-		if (count < ARRAY_SIZE) // prevent unbounded iteration
+		vm->clock = 13;
+		if (vm->count < ARRAY_SIZE) // prevent unbounded iteration
 		{
-			cells[SAFE_IDX(IP + count)] = adcread(3); // get output signal (safe index)
-			count++;
+			CSET(vm->cells, IP + vm->count, adcread(3)); // get output signal (safe index)
+			vm->count++;
 		}
 		return IP; // just keeps on going
 	}
 	else
-		return IP + insdir;
+		return IP + vm->insdir;
 }
 
 // 2- clock every hour - instruction counter or IP -some kind of TICK
-unsigned char redclock(unsigned char *cells, unsigned char IP)
+static unsigned char redclock(VMState *vm, unsigned char IP)
 {
-	clock++;
-	if (clock % 60 == 0)
+	vm->clock++;
+	if (vm->clock % 60 == 0)
 	{
-		OCR0A ^= 255;
+		vm_play(vm, vm->out ^ 255);
 		return IP; // everyone stops
 	}
 	else
-		return IP + insdir;
+		return IP + vm->insdir;
 }
 
 // 4- seven rooms: divide cellspace into 7 - 7 layers with filter each
-unsigned char redrooms(unsigned char *cells, unsigned char IP)
+static unsigned char redrooms(VMState *vm, unsigned char IP)
 {
-	switch (IP % 7)
-	{
-	case 0:
-		// blue
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-		filterk = 8;
-		break;
-	case 1:
-		// purple
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-		break;
-	case 2:
-		// green
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-		filterk = 8;
-		break;
-	case 3:
-		// orange
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-		break;
-	case 4:
-		// white
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // divide by 64
-		break;
-	case 5:
-		// violet
-		sbi(DDRB, PORTB1);
-		TCCR1B = (1 << WGM12) | (1 << CS12); // 256
-		break;
-	case 6:
-		// black
-		cbi(DDRB, PORTB1); // filter off
-	}
-	return IP + insdir;
+	filter_apply(&filter_rooms[IP % 7]);
+	filter_dirty = 1; // the knob profile comes back at the end of the pass
+	return IP + vm->insdir;
 }
 
 // 5- unmasking (change neighbouring cells)
 
-unsigned char redunmask(unsigned char *cells, unsigned char IP)
+static unsigned char redunmask(VMState *vm, unsigned char IP)
 {
-	cells[SAFE_IDX(IP - 1)] ^= 255; // safe index
-	cells[SAFE_IDX(IP + 1)] ^= 255; // safe index
-	return IP + insdir;
+	CSET(vm->cells, IP - 1, vm->cells[SAFE_IDX(IP - 1)] ^ 255); // safe index
+	CSET(vm->cells, IP + 1, vm->cells[SAFE_IDX(IP + 1)] ^ 255); // safe index
+	return IP + vm->insdir;
 }
 // 6- the prince (omem) - the output! walking through 7 rooms
 
-unsigned char redprospero(unsigned char *cells, unsigned char IP)
+static unsigned char redprospero(VMState *vm, unsigned char IP)
 {
 
-	unsigned char dirrr;
 	// prince/omem moves at random through rooms
-	dirrr = adcread(3) % 4; // get output signal
-	if (dirrr == 0)
-		omem = omem + 1;
-	else if (dirrr == 1)
-		omem = omem - 1;
-	else if (dirrr == 2)
-		omem = omem + 16;
-	else if (dirrr == 3)
-		omem = omem - 16;
+	vm->omem += bt_step(adcread(3) & 3); // get output signal
 
 	// output
-	OCR0A = cells[omem];
-	return IP + insdir;
+	vm_play(vm, vm->cells[vm->omem]);
+	return IP + vm->insdir;
 }
 
 // 7- the outside - the input!
-unsigned char redoutside(unsigned char *cells, unsigned char IP)
+static unsigned char redoutside(VMState *vm, unsigned char IP)
 {
 
 	// input sample to cell (which one neighbour to omem)
-	cells[SAFE_IDX(omem + 1)] = adcread(3); // get output signal (safe index)
+	CSET(vm->cells, vm->omem + 1, adcread(3)); // get output signal (safe index)
 
 	// output to filter
-	(*filtermod[qqq])((int)cells[omem]);
-	return IP + insdir;
+	(*filtermod[qqq])((int)vm->cells[vm->omem]);
+	return IP + vm->insdir;
 }
 
 /* plag - Plague Function Group
-   instructions for plague CPUs! */
+   instructions for plague CPUs!
+
+   Every plague is a resumable kernel: k(vm, budget) works through as
+   many cells as fit in budget cycles (at least one), keeps its cursor in
+   statics and carries on with the next call. The CELL_CYCLES costs are
+   estimates for avr-gcc -Os. Double-buffered plagues swap only after a
+   complete sweep. Returns 1 when a generation (sweep) was completed.
+*/
+#define MUTATE_CELL_CYCLES 30
+#define RECORD_CELL_CYCLES 20
+#define HODGE_CELL_CYCLES 150
+#define CEL_ROW_CYCLES 300
+#define CEL_ROW_SHIFT 3 // cel() wants 1 + ((step - 1) >> CEL_ROW_SHIFT) rows per call (1-4), budget permitting
+#define SIR_CELL_CYCLES 60
+#define LIFE_CELL_CYCLES 90
+
+static unsigned char orbit_noise; // this generation drew random numbers, it proves no fixed point
 
 /*
-	Plaque Mutate changes cell values to values from Filter Output until cells[0] value is reached
+	Plaque Mutate changes cells[0] cells per call with values from Filter Output
+	The samples come from cap_ring, filled by the ADC ISR, so no conversion is
+	waited for. Every call starts at the newest sample (cap_head - 1) and walks
+	back, like record(). A call applies at most budget / MUTATE_CELL_CYCLES
+	mutations (17 at PLAGUE_BUDGET 512), the rest stay pending for the next
+	call. The backlog is capped at 255, a larger cells[0] fills it and the
+	rate stays at the budget cap until cells[0] drops. Each call and each lap over the ring
+	add an odd offset, a sample seen again hits another cell instead of
+	undoing its own flip.
 */
-void mutate(unsigned char *cells)
+static unsigned char mutate_pending, mutate_lap; // backlog and offset, vm_attach() rewinds them
+
+unsigned char mutate(VMState *vm, unsigned int budget)
 {
-	unsigned char x, y;
-	unsigned int maxy = cells[0];
+	unsigned char *cells = vm->cells;
+	unsigned char x, r = cap_head, lap = mutate_lap, n = 0;
+	unsigned int maxy = mutate_pending + cells[0];
 	if (maxy > (ARRAY_SIZE - 1))
-		maxy = (ARRAY_SIZE - 1); // cap iterations to array size -1
-	for (y = 0; y < maxy; y++)
+		maxy = (ARRAY_SIZE - 1); // cap pending mutations to array size -1
+	mutate_pending = maxy;
+	mutate_lap += 61; // odd, walks all 256 offsets
+	while (mutate_pending)
+	{
+		r = (r - 1) & CAPTURE_MASK;
+		x = cap_ring[r] + lap; // feedback sample, newest first
+		if ((++n & CAPTURE_MASK) == 0)
+			lap += 61; // the ring is used again in this call
+		CSET(cells, x, cells[x] ^ (x & 0x0f));
+		mutate_pending--;
+		if (budget <= MUTATE_CELL_CYCLES)
+			break;
+		budget -= MUTATE_CELL_CYCLES;
+	}
+	return mutate_pending == 0;
+}
+/*
+	Plague Record copies the latest (cells[0] % CAPTURE_LEN) + 1 samples of the
+	feedback signal into the cells, oldest first, starting at omem.
+	The samples were taken at CAPTURE_RATE by the ADC scanner.
+	A copy cut short by the budget resumes where it stopped.
+*/
+static unsigned char record_n, record_r, record_x; // cells left, next sample, next cell
+
+unsigned char record(VMState *vm, unsigned int budget)
+{
+	unsigned char *cells = vm->cells;
+	if (record_n == 0)
 	{
-		x = adcread(3);					  // Read output signal
-		cells[SAFE_IDX(x)] ^= (x & 0x0f); // safe index
+		record_n = (cells[0] & CAPTURE_MASK) + 1;
+		record_r = cap_head - record_n; // oldest sample to copy
+		record_x = vm->omem;
+	}
+	for (;;)
+	{
+		CSET(cells, record_x, cap_ring[record_r & CAPTURE_MASK]);
+		record_r++;
+		record_x++;
+		if (--record_n == 0)
+			return 1;
+		if (budget <= RECORD_CELL_CYCLES)
+			return 0;
+		budget -= RECORD_CELL_CYCLES;
 	}
 }
+
 /*
 	Plague Hodge Implementation
 	Switches every 110 Cycles the cells array with newcells array
-
+	The 3x3 window slides along the half-space, each step loads only the new
+	right column and reuses the other two. Divisions are reciprocal multiplies
+	from hodge_recip[], see hodge_div().
+	With DIRTY_ROWS a generation skips the rows whose window (2 rows up and
+	down, the row ends wrap) and output did not change since hodge() last
+	computed them from the same half-space; a change in row 0 (q, k1, k2, g)
+	computes all rows.
 */
+static const unsigned int hodge_recip[256] PROGMEM = {
+	0, 0, 32768, 21846, 16384, 13108, 10923, 9363, 8192, 7282, 6554, 5958, 5462, 5042, 4682, 4370,
+	4096, 3856, 3641, 3450, 3277, 3121, 2979, 2850, 2731, 2622, 2521, 2428, 2341, 2260, 2185, 2115,
+	2048, 1986, 1928, 1873, 1821, 1772, 1725, 1681, 1639, 1599, 1561, 1525, 1490, 1457, 1425, 1395,
+	1366, 1338, 1311, 1286, 1261, 1237, 1214, 1192, 1171, 1150, 1130, 1111, 1093, 1075, 1058, 1041,
+	1024, 1009, 993, 979, 964, 950, 937, 924, 911, 898, 886, 874, 863, 852, 841, 830,
+	820, 810, 800, 790, 781, 772, 763, 754, 745, 737, 729, 721, 713, 705, 698, 690,
+	683, 676, 669, 662, 656, 649, 643, 637, 631, 625, 619, 613, 607, 602, 596, 591,
+	586, 580, 575, 570, 565, 561, 556, 551, 547, 542, 538, 533, 529, 525, 521, 517,
+	512, 509, 505, 501, 497, 493, 490, 486, 482, 479, 475, 472, 469, 465, 462, 459,
+	456, 452, 449, 446, 443, 440, 437, 435, 432, 429, 426, 423, 421, 418, 415, 413,
+	410, 408, 405, 403, 400, 398, 395, 393, 391, 388, 386, 384, 382, 379, 377, 375,
+	373, 371, 369, 367, 365, 363, 361, 359, 357, 355, 353, 351, 349, 347, 345, 344,
+	342, 340, 338, 337, 335, 333, 331, 330, 328, 327, 325, 323, 322, 320, 319, 317,
+	316, 314, 313, 311, 310, 308, 307, 305, 304, 303, 301, 300, 298, 297, 296, 294,
+	293, 292, 290, 289, 288, 287, 285, 284, 283, 282, 281, 279, 278, 277, 276, 275,
+	274, 272, 271, 270, 269, 268, 267, 266, 265, 264, 263, 262, 261, 260, 259, 258,
+}; // ceil(65536 / d), d = 0 and 1 are not used
 
-void hodge(unsigned char *cellies)
-{
-	int sum = 0, numill = 0, numinf = 0; // max value 32767
-	unsigned char q, k1, k2, g;
-	static unsigned char CoreCellx = CELLLEN + 1;  // raises every time function is called
-	static unsigned char flag = 0;				   // Toggle Flag
-	static unsigned char *newcells, *cells, *swap; // Changed variables to static
+/*
+n / d, exact for n < 2304 (9 * 256) with d <= 9 and for n <= 8 with any d,
+which covers sum / (numinf + 1) and numinf / k1, numill / k2
+*/
+static inline unsigned int hodge_div(unsigned int n, unsigned char d)
+{
+	if (d == 1)
+		return n;
+	return ((unsigned long)n * pgm_read_word(&hodge_recip[d])) >> 16;
+}
+
+#define HODGE_END ((MAX_SAM / 2) - CELLLEN - 1) // last cell of a sweep, the first is CELLLEN + 1
+
+static unsigned char hodge_x = CELLLEN + 1; // sweep cursor, CELLLEN + 1 starts a generation
+static unsigned char hodge_flag;			// Toggle Flag
+static unsigned char hodge_act = 0xFF;		// rows of this generation to compute
+#if DIRTY_ROWS
+static unsigned char hodge_pend[2] = {0xFF, 0xFF}; // rows changed since a generation last read the half-space
+static unsigned char hodge_clob[2];				   // rows written by someone else since hodge() wrote them
+#endif
+
+unsigned char hodge(VMState *vm, unsigned int budget)
+{
+	unsigned char *cellies = vm->cells;
+	unsigned int lsum, msum, rsum, v;
+	unsigned char numill, numinf, nv;
+	unsigned char q, q1, k1, k2, g, x, ret = 0, load = 1;
+	unsigned char l0, l1, l2, m0, m1, m2, r0, r1, r2; // window columns left/mid/right, rows above/on/below
+	unsigned char *newcells, *cells;
+#if DIRTY_ROWS
+	unsigned char d = hodge_flag & 0x01, in, out;
+	unsigned int e;
+
+	// fold in the writes since the last call, none of them are ours
+	e = hodge_dirty;
+	hodge_dirty = 0;
+	if (e & 0x0100)
+		e |= 0x0080; // cellies[127] is also read as offset 127 of the lower half-space
+	hodge_pend[0] |= e;
+	hodge_pend[1] |= e >> 8;
+	hodge_clob[0] |= e;
+	hodge_clob[1] |= e >> 8;
+	in = d ? e >> 8 : e;
+	out = d ? e : e >> 8;
+	if (hodge_x == CELLLEN + 1) // a new generation
+	{
+		in = hodge_pend[d];
+		out = hodge_clob[d ^ 1];
+		hodge_pend[d] = 0;
+		hodge_clob[d ^ 1] = 0;
+		hodge_act = 0;
+	}
+	if (in & 1)
+		hodge_act = 0xFF; // q, k1, k2 and g are in row 0
+	else
+		hodge_act |= in | (in << 1) | (in >> 1) | (in << 2) | (in >> 2) | out; // the window reaches 2 rows at the row ends
+#endif
 
 	// Swap where the cellies go
-	if ((flag & 0x01) == 0)
+	if ((hodge_flag & 0x01) == 0)
 	{
 		cells = cellies;
 		newcells = &cellies[MAX_SAM / 2];
@@ -957,127 +2033,355 @@ void hodge(unsigned char *cellies)
 		k2 = 1;
 	if (q == 0)
 		q = 1;
+	q1 = q - 1;
 
-	// Calculate sum of 3 neighbor cells values
-	sum = cells[SAFE_IDX(CoreCellx)] + cells[SAFE_IDX(CoreCellx - 1)] + cells[SAFE_IDX(CoreCellx + 1)] + cells[SAFE_IDX(CoreCellx - CELLLEN)] + cells[SAFE_IDX(CoreCellx + CELLLEN)] + cells[SAFE_IDX(CoreCellx - CELLLEN - 1)] + cells[SAFE_IDX(CoreCellx - CELLLEN + 1)] + cells[SAFE_IDX(CoreCellx + CELLLEN - 1)] + cells[SAFE_IDX(CoreCellx + CELLLEN + 1)]; // safe indices
-
-	// Decide which one is infected or ill.
-	if (cells[SAFE_IDX(CoreCellx - 1)] == (q - 1))
-		numill++;
-	else if (cells[SAFE_IDX(CoreCellx - 1)] > 0)
-		numinf++;
-	if (cells[SAFE_IDX(CoreCellx + 1)] == (q - 1))
-		numill++;
-	else if (cells[SAFE_IDX(CoreCellx + 1)] > 0)
-		numinf++;
-	if (cells[CoreCellx - CELLLEN] == (q - 1))
-		numill++;
-	else if (cells[CoreCellx - CELLLEN] > 0)
-		numinf++;
-	if (cells[CoreCellx + CELLLEN] == (q - 1))
-		numill++;
-	else if (cells[CoreCellx + CELLLEN] > 0)
-		numinf++;
-	if (cells[CoreCellx - CELLLEN - 1] == q)
-		numill++;
-	else if (cells[CoreCellx - CELLLEN - 1] > 0)
-		numinf++;
-	if (cells[CoreCellx - CELLLEN + 1] == q)
-		numill++;
-	else if (cells[CoreCellx - CELLLEN + 1] > 0)
-		numinf++;
-	if (cells[CoreCellx + CELLLEN - 1] == q)
-		numill++;
-	else if (cells[CoreCellx + CELLLEN - 1] > 0)
-		numinf++;
-	if (cells[CoreCellx + CELLLEN + 1] == q)
-		numill++;
-	else if (cells[CoreCellx + CELLLEN + 1] > 0)
-		numinf++;
-
-	// Sets the Values of Cells[0-127]
-	if (cells[CoreCellx] == 0)
-	{
-		// there is a slight chance cell value will raise up to 2
-		// sets the lowest integral number -maximal value is 2 = 1(numinf/k1) + 1 (numill/k2)
-		// Safe divisions: k1 and k2 are guaranteed non-zero
-		newcells[SAFE_IDX(CoreCellx % (MAX_SAM / 2))] = floor(numinf / k1) + floor(numill / k2); // safe index
-	}
-	else if (cells[CoreCellx] < q - 1) // if cells[CoreCellx]<cells[0]+1
-	{
-		// Safe division: (numinf + 1) is always >= 1
-		newcells[SAFE_IDX(CoreCellx % (MAX_SAM / 2))] = floor(sum / (numinf + 1)) + g; // safe index
-	}
-	else
+	x = hodge_x;
+	for (;;)
 	{
-		newcells[SAFE_IDX(CoreCellx % (MAX_SAM / 2))] = 0; // safe index
+		if (load)
+		{
+			while (x <= HODGE_END && !(hodge_act & pgm_read_byte(&bit8[x >> 4])))
+				x = (x | (CELLLEN - 1)) + 1; // window unchanged, the row is up to date
+			if (x > HODGE_END)
+				break;
+
+			// Window for the first cell of the run, CoreCellx stays within 17..110 so no index wraps
+			l0 = cells[x - CELLLEN - 1];
+			l1 = cells[x - 1];
+			l2 = cells[x + CELLLEN - 1];
+			m0 = cells[x - CELLLEN];
+			m1 = cells[x];
+			m2 = cells[x + CELLLEN];
+			lsum = l0 + l1 + l2;
+			msum = m0 + m1 + m2;
+			load = 0;
+		}
+
+		r0 = cells[x - CELLLEN + 1];
+		r1 = cells[x + 1];
+		r2 = cells[x + CELLLEN + 1];
+		rsum = r0 + r1 + r2;
+
+		// Decide which one is infected or ill.
+		numill = 0;
+		numinf = 0;
+		if (l1 == q1)
+			numill++;
+		else if (l1 > 0)
+			numinf++;
+		if (r1 == q1)
+			numill++;
+		else if (r1 > 0)
+			numinf++;
+		if (m0 == q1)
+			numill++;
+		else if (m0 > 0)
+			numinf++;
+		if (m2 == q1)
+			numill++;
+		else if (m2 > 0)
+			numinf++;
+		if (l0 == q)
+			numill++;
+		else if (l0 > 0)
+			numinf++;
+		if (r0 == q)
+			numill++;
+		else if (r0 > 0)
+			numinf++;
+		if (l2 == q)
+			numill++;
+		else if (l2 > 0)
+			numinf++;
+		if (r2 == q)
+			numill++;
+		else if (r2 > 0)
+			numinf++;
+
+		// Sets the Values of Cells[0-127]
+		if (m1 == 0)
+			v = hodge_div(numinf, k1) + hodge_div(numill, k2); // maximal value is 16 for k1 = k2 = 1
+		else if (m1 < q1)
+			v = hodge_div(lsum + msum + rsum, numinf + 1) + g;
+		else
+			v = 0;
+
+		nv = v; // stored as a byte like before, then clamped
+		if (nv > q1)
+			nv = q1;
+		CSET(cellies, newcells - cellies + x, nv);
+
+		x++; // next time take the next cell
+
+		if (x > HODGE_END)
+			break;
+#if HODGE_STEP == HODGE_ONE
+		break;
+#elif HODGE_STEP == HODGE_BUDGET
+		if (budget <= HODGE_CELL_CYCLES)
+			break;
+		budget -= HODGE_CELL_CYCLES;
+#endif
+		if ((x & (CELLLEN - 1)) == 0)
+		{
+			load = 1; // next row, it may be skipped
+			continue;
+		}
+
+		// slide the window one column to the right
+		l0 = m0;
+		l1 = m1;
+		l2 = m2;
+		m0 = r0;
+		m1 = r1;
+		m2 = r2;
+		lsum = msum;
+		msum = rsum;
 	}
 
-	if (newcells[SAFE_IDX(CoreCellx % (MAX_SAM / 2))] > q - 1)
-		newcells[SAFE_IDX(CoreCellx % (MAX_SAM / 2))] = q - 1; // safe index
+	// if CoreCellx reaches 110, reset CoreCellx and swap cells and newcells
+	if (x > HODGE_END)
+	{
+		x = CELLLEN + 1;
+		hodge_flag ^= 0x01; // Toggle Flag, the next call reads the new generation
+		ret = 1;
+	}
+	hodge_x = x;
+#if DIRTY_ROWS
+	e = hodge_dirty; // our own writes, the next generation reads them
+	hodge_dirty = 0;
+	hodge_pend[d ^ 1] |= d ? e : e >> 8;
+#endif
+	return ret;
+}
+/*
+	Plague Cel Algorithm
+	Elementary CA with rule cells[0], row l (thresholded at > 128) makes row l + 1.
+	Columns 1-15 are written as 0 or 255, the right neighbour of column 15 is
+	column 0 of the next row. A row is packed into a 16-bit word once, the rule
+	is evaluated for all columns at once as a 3 level bitwise multiplexer on
+	the left, self and right neighbour words. The rows per call follow the
+	plague step knob, a slow plague (large step) makes more rows per call.
+	The budget caps them (one row is always made), with PLAGUE_BUDGET 512
+	that is two rows, so a call stays within a scheduler tick.
+*/
+static unsigned char cel_row; // row made by the last call
 
-	CoreCellx++; // next time take the next cell
+unsigned char cel(VMState *vm, unsigned int budget)
+{
+	unsigned char *cells = vm->cells;
+	unsigned char rule, x, *row, n = ((step - 1) >> CEL_ROW_SHIFT) + 1;
+	unsigned int self, left, right, m0, m1, m2, m3, m4, m5, m6, m7, p0, p1, p2, p3, q0, q1, next;
 
-	// if CoreCellx reaches 110, reset CoreCellx, swap cells and newcells;
-	if (CoreCellx > ((MAX_SAM / 2) - CELLLEN - 1))
+	for (;;)
 	{
-		CoreCellx = CELLLEN + 1;
-		//    swap = cells; cells = newcells; newcells = swap;
-		swap = cells;
-		cells = newcells;
-		newcells = swap;
+		cel_row++;
+		cel_row %= CELLLEN;
+		rule = cells[0];
+		row = &cells[cel_row * CELLLEN];
+
+		self = 0;
+		for (x = CELLLEN; x--;)
+			self = (self << 1) | (row[x] > 128);
+		left = self << 1;															   // bit c = column c - 1
+		right = (self >> 1) | ((cells[SAFE_IDX((cel_row + 1) * CELLLEN)] > 128) ? 0x8000 : 0); // col 15 of row 15 wraps to cell 0
+
+		// rule bit k as a full word, k = right << 2 | self << 1 | left
+		m0 = -(unsigned int)(rule & 1);
+		m1 = -(unsigned int)((rule >> 1) & 1);
+		m2 = -(unsigned int)((rule >> 2) & 1);
+		m3 = -(unsigned int)((rule >> 3) & 1);
+		m4 = -(unsigned int)((rule >> 4) & 1);
+		m5 = -(unsigned int)((rule >> 5) & 1);
+		m6 = -(unsigned int)((rule >> 6) & 1);
+		m7 = -(unsigned int)((rule >> 7) & 1);
+		p0 = (left & m1) | (~left & m0);
+		p1 = (left & m3) | (~left & m2);
+		p2 = (left & m5) | (~left & m4);
+		p3 = (left & m7) | (~left & m6);
+		q0 = (self & p1) | (~self & p0);
+		q1 = (self & p3) | (~self & p2);
+		next = (right & q1) | (~right & q0);
+
+		row = &cells[((cel_row + 1) % CELLLEN) * CELLLEN];
+		for (x = 1, next >>= 1; x < CELLLEN; x++, next >>= 1)
+		{
+			if (row[x] != ((next & 1) ? 255 : 0))
+				CSET(cells, row - cells + x, (next & 1) ? 255 : 0);
+		}
 
-		flag ^= 0x01; // Toggle Flag
+		if (n <= 1 || budget <= CEL_ROW_CYCLES) // at least one row, also before the knobs set step
+			return 1;
+		n--;
+		budget -= CEL_ROW_CYCLES;
 	}
 }
+
 /*
-	Plague Cel Algorithm
-	Changes up to 16 Cells to 0 or 255
+	Plague SIR Algorithm
+	Sets value of cells to recovered(129), susceptible(0) or 1
+*/
+#if SIR_ACTIVE
+/*
+	Only cells that can change are visited: infected cells, their neighbours
+	and cells whose two half-space copies still differ. Every other cell is
+	settled, both copies hold 0 or recovered and no neighbour is infected.
+	The set for the next generation is built while visiting; cells written
+	by someone else (sir_touched) and infected cells in the read-only border
+	rows are added with their neighbours. Cells are visited in ascending
+	order, so the PRNG is drawn for the same cells in the same order as the
+	full sweep. A change of kk reclassifies everything and forces a sweep.
 */
-void cel(unsigned char *cells)
+#define SIR_END ((MAX_SAM / 2) - CELLLEN) // first cell after the swept range
+
+static unsigned char sir_set[2][16]; // visit bitsets of this and the next generation
+static unsigned char sir_cur;		 // sir_set index of this generation
+static unsigned char sir_full = 1;	 // next generation visits every cell
+
+static inline void sir_mark(unsigned char *set, unsigned char x)
+{
+	x &= 127;
+	set[x >> 3] |= pgm_read_byte(&bit8[x & 7]);
+}
+
+/* cell and its four neighbours */
+static void sir_mark5(unsigned char *set, unsigned char x)
 {
+	sir_mark(set, x);
+	sir_mark(set, x - 1);
+	sir_mark(set, x + 1);
+	sir_mark(set, x - CELLLEN);
+	sir_mark(set, x + CELLLEN);
+}
 
-	static unsigned char l = 0;
-	unsigned char cell, state, res;
-	unsigned char rule = cells[0];
-	res = 0;
-	l++;
-	l %= CELLLEN;
+static unsigned char sir_x = CELLLEN; // sweep cursor
+static unsigned char sir_flag;		 // Toggle Flag
+static unsigned char sir_kk, sir_p;	 // latched at the start of a sweep
+
+unsigned char SIR(VMState *vm, unsigned int budget)
+{
+	unsigned char *cellies = vm->cells;
+	unsigned char cell, nv, b, t, n;
+	unsigned char *newcells, *cells = 0, *act, *next;
 
-	for (cell = 1; cell < CELLLEN; cell++)
+	if ((sir_flag & 0x01) == 0)
+	{
+		cells = cellies;
+		newcells = &cellies[MAX_SAM / 2];
+	}
+	else
 	{
-		state = 0;
-		if (cells[cell + 1 + (l * CELLLEN)] > 128)
-			state |= 0x4;
-		if (cells[cell + (CELLLEN * l)] > 128)
-			state |= 0x2;
-		if (cells[cell - 1 + (CELLLEN * l)] > 128)
-			state |= 0x1;
+		cells = &cellies[MAX_SAM / 2];
+		newcells = cellies;
+	}
+	act = sir_set[sir_cur];
+	next = sir_set[sir_cur ^ 1];
 
-		if ((rule >> state) & 1)
+	if (sir_x == CELLLEN)
+	{
+		if (cellies[0] != sir_kk)
+			sir_full = 1;
+		sir_kk = cellies[0];
+		sir_p = cellies[1];
+		for (b = 0; b < 16; b++)
 		{
-			res += 1; // Todo:Warum wird res benutzt?
-			cells[cell + (((l + 1) % CELLLEN) * CELLLEN)] = 255;
+			if (sir_full)
+				act[b] = 0xFF;
+			next[b] = 0;
 		}
-		else
+		sir_full = 0;
+		for (b = 0; b < CELLLEN; b++) // border rows are read as neighbours but never written
+		{
+			if (cells[b] > 0 && cells[b] < sir_kk)
+				sir_mark5(act, b);
+			if (cells[SIR_END + b] > 0 && cells[SIR_END + b] < sir_kk)
+				sir_mark5(act, SIR_END + b);
+		}
+	}
+
+	// writes since the last call, by handlers or other plagues
+	for (b = 0; b < 16; b++)
+	{
+		t = sir_touched[b];
+		for (n = b << 3; t; n++, t >>= 1)
+		{
+			if (t & 1)
+			{
+				sir_mark5(act, n);
+				sir_mark5(next, n);
+			}
+		}
+	}
+
+	while (sir_x < SIR_END)
+	{
+		if (act[sir_x >> 3] == 0)
+		{
+			sir_x = (sir_x | 7) + 1; // nothing to do in these 8 cells
+			continue;
+		}
+		if (!(act[sir_x >> 3] & pgm_read_byte(&bit8[sir_x & 7])))
 		{
-			cells[cell + (((l + 1) % CELLLEN) * CELLLEN)] = 0;
+			sir_x++;
+			continue;
 		}
+
+		cell = cells[sir_x];
+		nv = cell;
+		if (cell >= sir_kk)
+			nv = recovered;
+		else if (cell > 0)
+			nv = cell + 1;
+		else if ((cells[sir_x - CELLLEN] > 0 && cells[sir_x - CELLLEN] < sir_kk) ||
+				 (cells[sir_x + CELLLEN] > 0 && cells[sir_x + CELLLEN] < sir_kk) ||
+				 (cells[sir_x - 1] > 0 && cells[sir_x - 1] < sir_kk) ||
+				 (cells[sir_x + 1] > 0 && cells[sir_x + 1] < sir_kk))
+		{
+			orbit_noise = 1;
+			if (prng_p10(sir_p))
+				nv = 1;
+		}
+		CSET(cellies, newcells - cellies + sir_x, nv);
+
+		if (nv > 0 && nv < sir_kk)
+			sir_mark5(next, sir_x); // infected, its neighbours may catch it
+		else if (nv != cells[sir_x] || (nv >= sir_kk && nv != recovered))
+			sir_mark(next, sir_x); // not settled yet
+
+		sir_x++;
+		if (budget <= SIR_CELL_CYCLES)
+			break;
+		budget -= SIR_CELL_CYCLES;
 	}
+
+	for (b = 0; b < 16; b++)
+		sir_touched[b] = 0; // our own writes above
+
+	if (sir_x < SIR_END)
+		return 0;
+	sir_x = CELLLEN;
+	sir_flag ^= 0x01;
+	sir_cur ^= 1;
+	return 1;
 }
+#else
+static unsigned char sir_x = CELLLEN; // sweep cursor
+static unsigned char sir_flag;		 // Toggle Flag
+static unsigned char sir_kk, sir_p;	 // latched at the start of a sweep
 
-/*
-	Plague SIR Algorithm
-	Sets value of cells to recovered(129), susceptible(0) or 1
-*/
-void SIR(unsigned char *cellies)
+unsigned char SIR(VMState *vm, unsigned int budget)
 {
-	unsigned char cell, x = 0;
-	static unsigned char flag = 0; // Toggle Flag
+	unsigned char *cellies = vm->cells;
+	unsigned char cell, nv;
 	unsigned char *newcells, *cells = 0;
-	unsigned char kk = cellies[0], p = cellies[1];
 
-	if ((flag & 0x01) == 0)
+	if (sir_x == CELLLEN)
+	{
+		sir_kk = cellies[0];
+		sir_p = cellies[1];
+	}
+
+	if ((sir_flag & 0x01) == 0)
 	{
 		cells = cellies;
 		newcells = &cellies[MAX_SAM / 2];
@@ -1088,42 +2392,158 @@ void SIR(unsigned char *cellies)
 		newcells = cellies;
 	}
 
-	for (x = CELLLEN; x < ((MAX_SAM / 2) - CELLLEN); x++)
+	for (;;)
 	{
-		cell = cells[x];
-		newcells[SAFE_IDX(x)] = cell; // safe index
-		if (cell >= kk)
-			newcells[SAFE_IDX(x)] = recovered; // safe index
-		else if ((cell > 0 && cell < kk))
+		cell = cells[sir_x];
+		nv = cell;
+		if (cell >= sir_kk)
+			nv = recovered;
+		else if ((cell > 0 && cell < sir_kk))
 		{
-			newcells[SAFE_IDX(x)]++; // safe index
+			nv++;
 		}
 		else if (cell == susceptible)
 		{
 
-			if ((cells[SAFE_IDX(x - CELLLEN)] > 0 && cells[SAFE_IDX(x - CELLLEN)] < kk) || // safe indices
-				(cells[SAFE_IDX(x + CELLLEN)] > 0 && cells[SAFE_IDX(x + CELLLEN)] < kk) ||
-				(cells[SAFE_IDX(x - 1)] > 0 && cells[SAFE_IDX(x - 1)] < kk) ||
-				(cells[SAFE_IDX(x + 1)] > 0 && cells[SAFE_IDX(x + 1)] < kk))
+			if ((cells[SAFE_IDX(sir_x - CELLLEN)] > 0 && cells[SAFE_IDX(sir_x - CELLLEN)] < sir_kk) || // safe indices
+				(cells[SAFE_IDX(sir_x + CELLLEN)] > 0 && cells[SAFE_IDX(sir_x + CELLLEN)] < sir_kk) ||
+				(cells[SAFE_IDX(sir_x - 1)] > 0 && cells[SAFE_IDX(sir_x - 1)] < sir_kk) ||
+				(cells[SAFE_IDX(sir_x + 1)] > 0 && cells[SAFE_IDX(sir_x + 1)] < sir_kk))
 			{
-				if (rand() % 10 < p)
-					newcells[SAFE_IDX(x)] = 1; // safe index
+				orbit_noise = 1;
+				if (prng_p10(sir_p))
+					nv = 1;
 			}
 		}
+		CSET(cellies, newcells - cellies + sir_x, nv);
+
+		if (++sir_x >= ((MAX_SAM / 2) - CELLLEN))
+		{
+			sir_x = CELLLEN;
+			sir_flag ^= 0x01;
+			return 1;
+		}
+		if (budget <= SIR_CELL_CYCLES)
+			return 0;
+		budget -= SIR_CELL_CYCLES;
 	}
-	flag ^= 0x01;
 }
+#endif
 /*
 	Plague Life Algorithm
 */
-void life(unsigned char *cellies)
-{
-	unsigned char x, sum;
+#if LIFE_PACKED
+/*
+	Bit-packed life on the 16x16 torus, one generation per call.
+	A row is a uint16_t (bit = column), alive = odd cell value like the % 2
+	test of the byte version. The 8 neighbours are counted for all 16
+	columns at once with full/half adders on the shifted neighbour rows.
+	Only rows written by someone else are packed again, and only cells whose
+	state changed are written back as 0/255 (a stale row is written whole).
+	A row whose neighbour rows did not change since the last generation
+	keeps its cells, so only rows next to changed or stale rows are
+	computed (DIRTY_ROWS).
+	About 3000 cycles per full generation (estimate), the budget is not split.
+*/
+static unsigned int life_rows[CELLLEN]; // generation as last written to the cells
+static unsigned int life_moved;			// rows changed by the last generation
+
+unsigned char life(VMState *vm, unsigned int budget)
+{
+	unsigned char *cells = vm->cells;
+	unsigned int next[CELLLEN];
+	unsigned int up, mid, dn, a, b, c, d, e, f, g, h, t;
+	unsigned int u0, u1, w0, w1, v0, v1, s0, s1, x1, y0, y1, changed, alive;
+	unsigned int stale = life_dirty, act, moved = 0;
+	unsigned char r, x, *row;
+
+#if DIRTY_ROWS
+	act = stale | life_moved;
+	act |= (act << 1) | (act >> 15) | (act >> 1) | (act << 15); // and their neighbours on the torus
+#else
+	act = 0xFFFF;
+#endif
+
+	for (r = 0; r < CELLLEN; r++)
+	{
+		if (!(stale & row_bit(r)))
+			continue;
+		row = &cells[r * CELLLEN];
+		mid = 0;
+		for (x = CELLLEN; x--;)
+			mid = (mid << 1) | (row[x] & 1);
+		life_rows[r] = mid;
+	}
+
+	for (r = 0; r < CELLLEN; r++)
+	{
+		if (!(act & row_bit(r)))
+		{
+			next[r] = life_rows[r]; // neighbourhood unchanged
+			continue;
+		}
+		up = life_rows[(r - 1) & (CELLLEN - 1)];
+		mid = life_rows[r];
+		dn = life_rows[(r + 1) & (CELLLEN - 1)];
+		a = (up << 1) | (up >> 15); // neighbour to the left
+		b = up;
+		c = (up >> 1) | (up << 15); // neighbour to the right
+		d = (mid << 1) | (mid >> 15);
+		e = (mid >> 1) | (mid << 15);
+		f = (dn << 1) | (dn >> 15);
+		g = dn;
+		h = (dn >> 1) | (dn << 15);
+
+		t = a ^ b; // full adder, row above
+		u0 = t ^ c;
+		u1 = (a & b) | (c & t);
+		t = f ^ g; // full adder, row below
+		w0 = t ^ h;
+		w1 = (f & g) | (h & t);
+		v0 = d ^ e; // half adder, left and right
+		v1 = d & e;
+		t = u0 ^ w0; // ones
+		s0 = t ^ v0;
+		x1 = (u0 & w0) | (v0 & t);
+		t = u1 ^ w1; // twos
+		y0 = t ^ v1;
+		y1 = (u1 & w1) | (v1 & t);
+		s1 = y0 ^ x1;
+		// 3 neighbours, or 2 and alive (8 neighbours wraps to 0)
+		next[r] = s1 & ~(y1 ^ (y0 & x1)) & (s0 | mid);
+	}
+
+	for (r = 0; r < CELLLEN; r++)
+	{
+		changed = next[r] ^ life_rows[r];
+		if (changed)
+			moved |= row_bit(r);
+		if (stale & row_bit(r))
+			changed = 0xFFFF;
+		alive = next[r];
+		life_rows[r] = alive;
+		for (x = r * CELLLEN; changed; x++, changed >>= 1, alive >>= 1)
+		{
+			if (changed & 1)
+				CSET(cells, x, (alive & 1) ? 255 : 0);
+		}
+	}
 
-	static unsigned char flag = 0;
+	life_moved = moved;
+	life_dirty = 0; // our own writes above
+	return 1;
+}
+#else
+static unsigned char life_x = CELLLEN + 1; // sweep cursor
+static unsigned char life_flag;			   // Toggle Flag
+
+unsigned char life(VMState *vm, unsigned int budget)
+{
+	unsigned char *cellies = vm->cells;
+	unsigned char sum;
 	unsigned char *newcells, *cells = 0;
 
-	if ((flag & 0x01) == 0)
+	if ((life_flag & 0x01) == 0)
 	{
 		cells = cellies;
 		newcells = &cellies[MAX_SAM / 2];
@@ -1134,46 +2554,631 @@ void life(unsigned char *cellies)
 		newcells = cellies;
 	}
 
-	for (x = CELLLEN + 1; x < ((MAX_SAM / 2) - CELLLEN - 1); x++)
+	for (;;)
 	{
-		sum = cells[SAFE_IDX(x)] % 2 + cells[SAFE_IDX(x - 1)] % 2 + cells[SAFE_IDX(x + 1)] % 2 + cells[SAFE_IDX(x - CELLLEN)] % 2 + cells[SAFE_IDX(x + CELLLEN)] % 2 + cells[SAFE_IDX(x - CELLLEN - 1)] % 2 + cells[SAFE_IDX(x - CELLLEN + 1)] % 2 + cells[SAFE_IDX(x + CELLLEN - 1)] % 2 + cells[SAFE_IDX(x + CELLLEN + 1)] % 2; // safe indices
-		sum = sum - cells[SAFE_IDX(x)] % 2;
-		if (sum == 3 || (sum + (cells[SAFE_IDX(x)] % 2) == 3))
-			newcells[SAFE_IDX(x)] = 255;
+		sum = cells[SAFE_IDX(life_x)] % 2 + cells[SAFE_IDX(life_x - 1)] % 2 + cells[SAFE_IDX(life_x + 1)] % 2 + cells[SAFE_IDX(life_x - CELLLEN)] % 2 + cells[SAFE_IDX(life_x + CELLLEN)] % 2 + cells[SAFE_IDX(life_x - CELLLEN - 1)] % 2 + cells[SAFE_IDX(life_x - CELLLEN + 1)] % 2 + cells[SAFE_IDX(life_x + CELLLEN - 1)] % 2 + cells[SAFE_IDX(life_x + CELLLEN + 1)] % 2; // safe indices
+		sum = sum - cells[SAFE_IDX(life_x)] % 2;
+		if (sum == 3 || (sum + (cells[SAFE_IDX(life_x)] % 2) == 3))
+			CSET(cellies, newcells - cellies + life_x, 255);
 		else
-			newcells[SAFE_IDX(x)] = 0;
+			CSET(cellies, newcells - cellies + life_x, 0);
+
+		if (++life_x >= ((MAX_SAM / 2) - CELLLEN - 1))
+		{
+			life_x = CELLLEN + 1;
+			life_flag ^= 0x01; // swapping
+			return 1;
+		}
+		if (budget <= LIFE_CELL_CYCLES)
+			return 0;
+		budget -= LIFE_CELL_CYCLES;
+	}
+}
+#endif
+
+/*
+Plague Orbits
+A deterministic plague (no PRNG draw, nobody else writing cells) whose
+generations stop changing any cell has reached a fixed point, every further
+generation would compute the same cells again. The kernel is parked until a
+cell changes (CPU, knobs via cells, another plague). orbit_fixed[] is the
+number of quiet generations that proves it: 2 for double-buffered plagues
+(both half-spaces), 16 calls for cel (every row seen once), 0 = never park
+(mutate and record follow the feedback signal).
+Longer periods are only detected and reported in orbit_period: a cached
+state would need the whole cell array, which does not fit next to it.
+*/
+#define ORBIT_HIST 8 // signatures kept for period detection
+
+static const unsigned char orbit_fixed[8] PROGMEM = {0, 2, 2, 16, 2, 2, LIFE_PACKED ? 1 : 2, 0}; // per plag[] slot
+
+static unsigned char orbit_plague = 0xFF; // plag[] slot the orbit state belongs to
+static unsigned char orbit_quiet;		  // generations without a cell change
+static unsigned char orbit_parked;
+static unsigned int orbit_hist[ORBIT_HIST]; // change signatures of the last generations
+static unsigned char orbit_pos;
+unsigned char orbit_period;						  // 0 = none seen, else period in generations
+unsigned int plague_generations, plague_skipped; // completed generations, calls skipped while parked
+
+typedef unsigned char (*plague_t)(VMState *vm, unsigned int budget);
+
+static const plague_t plag[] PROGMEM = {mutate, SIR, hodge, cel, hodge, SIR, life, record};
+
+/*
+One generation completed: look up its signature, then park on a fixed point
+*/
+static void orbit_generation(void)
+{
+	unsigned char i, n;
+
+	plague_generations++;
+	if (orbit_changed && !orbit_noise)
+	{
+		orbit_period = 0;
+		for (i = 0, n = orbit_pos; i < ORBIT_HIST; i++) // newest first
+		{
+			n = (n - 1) & (ORBIT_HIST - 1);
+			if (orbit_hist[n] == orbit_sig)
+			{
+				orbit_period = i + 1;
+				break;
+			}
+		}
+		orbit_hist[orbit_pos] = orbit_sig;
+		orbit_pos = (orbit_pos + 1) & (ORBIT_HIST - 1);
+	}
+	if (orbit_changed || orbit_noise)
+		orbit_quiet = 0;
+	else if (orbit_quiet < 255)
+		orbit_quiet++;
+	n = pgm_read_byte(&orbit_fixed[orbit_plague]);
+	if (n && orbit_quiet >= n)
+	{
+		orbit_parked = 1;
+		orbit_period = 1;
 	}
+	orbit_changed = 0;
+	orbit_noise = 0;
+	orbit_sig = 0;
+}
 
-	// swapping
-	flag ^= 0x01;
+/*
+Run plague k for one step, skipped while it sits on a fixed point
+*/
+static void plague_step(unsigned char k, VMState *vm)
+{
+	unsigned char i;
+
+	if (k != orbit_plague)
+	{
+		orbit_plague = k;
+		orbit_quiet = 0;
+		orbit_parked = 0;
+		orbit_period = 0;
+		for (i = 0; i < ORBIT_HIST; i++)
+			orbit_hist[i] = 0;
+		orbit_changed = 0;
+	}
+	if (orbit_parked)
+	{
+		if (!orbit_changed)
+		{
+			plague_skipped++;
+			return;
+		}
+		orbit_parked = 0; // somebody wrote a cell, compute again
+		orbit_quiet = 0;
+	}
+	if (((plague_t)pgm_read_word(&plag[k]))(vm, PLAGUE_BUDGET))
+		orbit_generation();
 }
 
-int main(void)
+/*
+The opcache, the Redcode records, the Brainfuck links and the plague
+kernels (dirty rows, sweep cursors, double-buffer phase) remember what they
+saw in the cells of one VM. A host that runs several VMs attaches the next
+one before running it, they then read its cells from scratch and a sweep
+cut short on the last VM is dropped.
+*/
+static VMState *vm_attached;
+
+static void vm_attach(VMState *vm)
+{
+	if (vm == vm_attached)
+		return;
+	vm_attached = vm;
+#if OPCACHE
+	opcache_cpu = 0xFF; // refilled (with the Brainfuck links and Redcode records) on the next step
+#endif
+#if LIFE_PACKED
+	life_dirty = 0xFFFF;
+#endif
+#if DIRTY_ROWS
+	hodge_dirty = 0xFFFF;
+#endif
+#if SIR_ACTIVE
+	sir_full = 1;
+#endif
+	orbit_plague = 0xFF;
+
+	// the kernels start over instead of resuming a sweep over the cells of the last VM
+	mutate_pending = 0;
+	mutate_lap = 0;
+	record_n = 0;
+	hodge_x = CELLLEN + 1;
+	hodge_flag = 0;
+	hodge_act = 0xFF;
+#if DIRTY_ROWS
+	hodge_pend[0] = hodge_pend[1] = 0xFF;
+	hodge_clob[0] = hodge_clob[1] = 0;
+#endif
+	cel_row = 0;
+	sir_x = CELLLEN;
+	sir_flag = 0;
+#if !LIFE_PACKED
+	life_x = CELLLEN + 1;
+	life_flag = 0;
+#endif
+}
+
+/*
+Instruction Dispatch
+DISPATCH_SWITCH: one dense switch per instruction set calls the handlers
+directly, so GCC inlines the small ones into the dispatch and skips the
+icall, the argument shuffling and the call/return.
+DISPATCH_TABLE: the old function pointer tables (now in flash instead of
+being rebuilt on the stack by main()), one icall per instruction.
+*/
+#if DISPATCH == DISPATCH_TABLE
+typedef unsigned char (*instruction_t)(VMState *vm, unsigned char IP);
+static const instruction_t instructionsetfirst[] PROGMEM = {outff, outpp, finc, fdec, fincm, fdecm, fin1, fin2, fin3, fin4, outf, outp, plus, minus, bitshift1, bitshift2, bitshift3, branch, jump, infect, store, writeknob, writesamp, skip, direction, die}; // 26
+static const instruction_t instructionsetplague[] PROGMEM = {writeknob, writesamp, ploutf, ploutp, plenclose, plinfect, pldie, plwalk}; // 8
+static const instruction_t instructionsetbf[] PROGMEM = {bfinc, bfdec, bfincm, bfdecm, bfoutf, bfoutp, bfin, bfbrac1, bfbrac2}; // 9
+static const instruction_t instructionsetSIR[] PROGMEM = {SIRoutf, SIRoutp, SIRincif, SIRdieif, SIRrecif, SIRinfif}; // 6
+static const instruction_t instructionsetredcode[] PROGMEM = {rdmov, rdadd, rdsub, rdjmp, rdjmz, rdjmg, rddjz, rddat, rdcmp, rdoutf, rdoutp}; // 11
+static const instruction_t instructionsetbiota[] PROGMEM = {btempty, btoutf, btoutp, btstraight, btbackup, btturn, btunturn, btg, btclear, btdup}; // 10
+static const instruction_t instructionsetreddeath[] PROGMEM = {redplague, reddeath, redclock, redrooms, redunmask, redprospero, redoutside}; // 7
+#endif
+
+/* run one instruction of instructionsetfirst, op is 0..25 (with SUPERINSN marks in the top bits) */
+static inline unsigned char run_first(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if SUPERINSN
+	if ((op >> 5) && vm->insdir == 1 && vm->dir == 1)
+		return super_run(op >> 5, vm, IP);
+	op &= OP_MASK;
+#endif
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return outff(vm, IP);
+	case 1:
+		return outpp(vm, IP);
+	case 2:
+		return finc(vm, IP);
+	case 3:
+		return fdec(vm, IP);
+	case 4:
+		return fincm(vm, IP);
+	case 5:
+		return fdecm(vm, IP);
+	case 6:
+		return fin1(vm, IP);
+	case 7:
+		return fin2(vm, IP);
+	case 8:
+		return fin3(vm, IP);
+	case 9:
+		return fin4(vm, IP);
+	case 10:
+		return outf(vm, IP);
+	case 11:
+		return outp(vm, IP);
+	case 12:
+		return plus(vm, IP);
+	case 13:
+		return minus(vm, IP);
+	case 14:
+		return bitshift1(vm, IP);
+	case 15:
+		return bitshift2(vm, IP);
+	case 16:
+		return bitshift3(vm, IP);
+	case 17:
+		return branch(vm, IP);
+	case 18:
+		return jump(vm, IP);
+	case 19:
+		return infect(vm, IP);
+	case 20:
+		return store(vm, IP);
+	case 21:
+		return writeknob(vm, IP);
+	case 22:
+		return writesamp(vm, IP);
+	case 23:
+		return skip(vm, IP);
+	case 24:
+		return direction(vm, IP);
+	default:
+		return die(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetfirst[op]))(vm, IP);
+#endif
+}
+
+/* run one instruction of instructionsetplague, op is 0..7 */
+static inline unsigned char run_plague(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return writeknob(vm, IP);
+	case 1:
+		return writesamp(vm, IP);
+	case 2:
+		return ploutf(vm, IP);
+	case 3:
+		return ploutp(vm, IP);
+	case 4:
+		return plenclose(vm, IP);
+	case 5:
+		return plinfect(vm, IP);
+	case 6:
+		return pldie(vm, IP);
+	default:
+		return plwalk(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetplague[op]))(vm, IP);
+#endif
+}
+
+/* run one instruction of instructionsetbf, op is 0..8 (an opcache entry with BF_LINKED) */
+static inline unsigned char run_bf(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if BF_LINKED
+	op = bf_op(op);
+#endif
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return bfinc(vm, IP);
+	case 1:
+		return bfdec(vm, IP);
+	case 2:
+		return bfincm(vm, IP);
+	case 3:
+		return bfdecm(vm, IP);
+	case 4:
+		return bfoutf(vm, IP);
+	case 5:
+		return bfoutp(vm, IP);
+	case 6:
+		return bfin(vm, IP);
+	case 7:
+		return bfbrac1(vm, IP);
+	default:
+		return bfbrac2(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetbf[op]))(vm, IP);
+#endif
+}
+
+/* run one instruction of instructionsetSIR, op is 0..5 */
+static inline unsigned char run_SIR(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return SIRoutf(vm, IP);
+	case 1:
+		return SIRoutp(vm, IP);
+	case 2:
+		return SIRincif(vm, IP);
+	case 3:
+		return SIRdieif(vm, IP);
+	case 4:
+		return SIRrecif(vm, IP);
+	default:
+		return SIRinfif(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetSIR[op]))(vm, IP);
+#endif
+}
+
+/* run one instruction of instructionsetredcode, op is 0..10, returns the IP of the next process */
+static inline unsigned char run_redcode(unsigned char op, VMState *vm, unsigned char IP)
+{
+	rd_fetch(op, vm, IP);
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		IP = rdmov(vm, IP);
+		break;
+	case 1:
+		IP = rdadd(vm, IP);
+		break;
+	case 2:
+		IP = rdsub(vm, IP);
+		break;
+	case 3:
+		IP = rdjmp(vm, IP);
+		break;
+	case 4:
+		IP = rdjmz(vm, IP);
+		break;
+	case 5:
+		IP = rdjmg(vm, IP);
+		break;
+	case 6:
+		IP = rddjz(vm, IP);
+		break;
+	case 7:
+		IP = rddat(vm, IP);
+		break;
+	case 8:
+		IP = rdcmp(vm, IP);
+		break;
+	case 9:
+		IP = rdoutf(vm, IP);
+		break;
+	default:
+		IP = rdoutp(vm, IP);
+		break;
+	}
+#else
+	IP = ((instruction_t)pgm_read_word(&instructionsetredcode[op]))(vm, IP);
+#endif
+	return rd_next(vm, IP);
+}
+
+/* run one instruction of instructionsetbiota, op is 0..9 */
+static inline unsigned char run_biota(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return btempty(vm, IP);
+	case 1:
+		return btoutf(vm, IP);
+	case 2:
+		return btoutp(vm, IP);
+	case 3:
+		return btstraight(vm, IP);
+	case 4:
+		return btbackup(vm, IP);
+	case 5:
+		return btturn(vm, IP);
+	case 6:
+		return btunturn(vm, IP);
+	case 7:
+		return btg(vm, IP);
+	case 8:
+		return btclear(vm, IP);
+	default:
+		return btdup(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetbiota[op]))(vm, IP);
+#endif
+}
+
+/* run one instruction of instructionsetreddeath, op is 0..6 */
+static inline unsigned char run_reddeath(unsigned char op, VMState *vm, unsigned char IP)
+{
+#if DISPATCH == DISPATCH_SWITCH
+	switch (op)
+	{
+	case 0:
+		return redplague(vm, IP);
+	case 1:
+		return reddeath(vm, IP);
+	case 2:
+		return redclock(vm, IP);
+	case 3:
+		return redrooms(vm, IP);
+	case 4:
+		return redunmask(vm, IP);
+	case 5:
+		return redprospero(vm, IP);
+	default:
+		return redoutside(vm, IP);
+	}
+#else
+	return ((instruction_t)pgm_read_word(&instructionsetreddeath[op]))(vm, IP);
+#endif
+}
+
+/*
+Run one instruction of instruction set set (0..7) on the VM
+*/
+static inline void vm_step(VMState *vm, unsigned char set)
 {
+	vm->count++; // reddeath() walks with count
+#if REDCODE_TASKS > 1
+	if (set != 4)
+		vm->rd_in = 0;
+	else if (!vm->rd_in)
+	{
+		vm->rd_in = 1; // Redcode (re)entered, drop the processes of an older program
+		vm->rd_head = 0;
+		vm->rd_ntask = 0;
+	}
+#endif
 
-	unsigned char *cells = xxx;
+	// Which instruction group/algorithm is used?
+	switch (set)
+	{
+	case 0:
+		//
+		vm->ip = run_first(OPCODE(vm, set, 26), vm, vm->ip); // mistake before as was instruction%INSTLEN in last instance
+		//      insdir=dir*(IP%16)+1; // prev mistake as just got exponentially larger
+		vm->insdir = vm->dir; // set direction for next instruction
+		break;
+	case 1:
+		// Plague Alogrithms
+		vm->ip = run_plague(OPCODE(vm, set, 8), vm, vm->ip);
+		//	    insdir=dir*(IP%16)+1;
+		vm->insdir = vm->dir;
+		if (vm->cells[vm->ip] == 255 && vm->dir < 0)
+			vm->dir = 1;
+		else if (vm->cells[vm->ip] == 255 && vm->dir > 0)
+			vm->dir = -1; // barrier
+		break;
+	case 2:
+		// Brain Fuck Algorithms
+		vm->ip = run_bf(OPCODE(vm, set, 9), vm, vm->ip);
+		//	    insdir=dir*(IP%16)+1;
+		vm->insdir = vm->dir;
+		break;
+	case 3:
+		// SIR (susceptible, infected, recovered) Algorithms
+		vm->ip = run_SIR(OPCODE(vm, set, 6), vm, vm->ip);
+		//	    insdir=dir*(IP%16)+1;
+		vm->insdir = vm->dir;
+		break;
+	case 4:
+		// Red Code Algorithms
+		vm->ip = run_redcode(OPCODE(vm, set, 11), vm, vm->ip);
+		//	    insdir=dir*(IP%16)+1;
+		vm->insdir = vm->dir;
+		break;
+	case 5:
+		// direct output
+		instruction = vm->cells[SAFE_IDX(vm->ip)];
+		vm_play(vm, instruction);
+		vm->ip += vm->dir; // changed from insdir
+		break;
+	case 6:
+		// Red Death Algorithms
+		vm->ip = run_reddeath(OPCODE(vm, set, 7), vm, vm->ip);
+		//	    insdir=dir*(IP%16)+1;
+		vm->insdir = vm->dir;
+		break;
+	case 7:
+		// la biota Algorithms
+		vm->ip = run_biota(OPCODE(vm, set, 10), vm, vm->ip);
+		vm->ip += bt_step(vm->btdir);
+		break;
+	}
+}
 
-	// CPU Functions // Instruction Groups
-	unsigned char (*instructionsetfirst[])(unsigned char *cells, unsigned char IP) = {outff, outpp, finc, fdec, fincm, fdecm, fin1, fin2, fin3, fin4, outf, outp, plus, minus, bitshift1, bitshift2, bitshift3, branch, jump, infect, store, writeknob, writesamp, skip, direction, die}; // 26 instructions
+#if VM_CORES > 1
+/*
+Virtual CPUs
+VM_CORES interpreters walk the one cell space, each with its own registers
+(IP, omem, directions, ...) and instruction set. Core 0 lives in the
+VMState, the registers of the others wait in core_regs[] and are swapped in
+for their turn. Every CPU tick runs core_weight[k] instructions of every
+core k, round robin; the knob decode, the opcache and the plague are shared.
+Core k runs the set of the left knob plus core_offset[k]. With BF_LINKED /
+REDCODE_CACHE Brainfuck and Redcode need the opcache to hold their set,
+another core runs the set of core 0 instead. The samples the cores played
+in a round are mixed into one.
+*/
+static const unsigned char core_offset[4] PROGMEM = {0, 3, 5, 6};
+static const unsigned char core_weight[4] PROGMEM = {2, 1, 1, 1};
+static unsigned char core_regs[VM_CORES - 1][VM_CELLS]; // registers of cores 1 ..
+static unsigned char core_set[VM_CORES];					// instruction set of every core
 
-	unsigned char (*instructionsetplague[])(unsigned char *cells, unsigned char IP) = {writeknob, writesamp, ploutf, ploutp, plenclose, plinfect, pldie, plwalk}; // 8
+/*
+Exchange the registers in the VMState with those of core k
+*/
+static void core_swap(VMState *vm, unsigned char k)
+{
+	unsigned char *a = (unsigned char *)vm, *b = core_regs[k - 1], i, t;
+	for (i = 0; i < VM_CELLS; i++)
+	{
+		t = a[i];
+		a[i] = b[i];
+		b[i] = t;
+	}
+}
 
-	unsigned char (*instructionsetbf[])(unsigned char *cells, unsigned char IP) = {bfinc, bfdec, bfincm, bfdecm, bfoutf, bfoutp, bfin, bfbrac1, bfbrac2}; // 9
+/*
+Registers of the other cores as after power-up, they start spread over the cells
+*/
+static void cores_init(VMState *vm)
+{
+	unsigned char k;
+	for (k = 1; k < VM_CORES; k++)
+	{
+		core_swap(vm, k);
+		vm_reset(vm);
+		vm->ip = k << 6;
+		core_swap(vm, k);
+	}
+}
 
-	unsigned char (*instructionsetSIR[])(unsigned char *cells, unsigned char IP) = {SIRoutf, SIRoutp, SIRincif, SIRdieif, SIRrecif, SIRinfif}; // 6
+/*
+Instruction sets of the cores, set is the one of the left knob
+*/
+static void cores_select(unsigned char set)
+{
+	unsigned char k, s;
+	for (k = 0; k < VM_CORES; k++)
+	{
+		s = (set + pgm_read_byte(&core_offset[k])) & 7;
+#if BF_LINKED
+		if (s == 2)
+			s = set;
+#endif
+#if REDCODE_CACHE
+		if (s == 4)
+			s = set;
+#endif
+		core_set[k] = s;
+	}
+}
 
-	unsigned char (*instructionsetredcode[])(unsigned char *cells, unsigned char IP) = {rdmov, rdadd, rdsub, rdjmp, rdjmz, rdjmg, rddjz, rddat, rdcmp, rdoutf, rdoutp}; // 11
+/*
+One round: every core runs its weight, then their samples are mixed
+*/
+static void cores_run(VMState *vm)
+{
+	unsigned char k, n;
+	unsigned int mix = 0;
 
-	unsigned char (*instructionsetbiota[])(unsigned char *cells, unsigned char IP) = {btempty, btoutf, btoutp, btstraight, btbackup, btturn, btunturn, btg, btclear, btdup}; // 10
+	cores_played = 0;
+	for (k = 0; k < VM_CORES; k++)
+	{
+		if (k)
+			core_swap(vm, k);
+		for (n = pgm_read_byte(&core_weight[k]); n; n--)
+			vm_step(vm, core_set[k]);
+		mix += vm->out;
+		if (k)
+			core_swap(vm, k);
+	}
+	if (cores_played)
+		audio_push(mix >> (VM_CORES / 2)); // average, VM_CORES is 2 or 4
+}
+#endif
 
-	unsigned char (*instructionsetreddeath[])(unsigned char *cells, unsigned char IP) = {redplague, reddeath, redclock, redrooms, redunmask, redprospero, redoutside}; // 7
+int main(void)
+{
 
-	// Plague Function Group
-	void (*plag[])(unsigned char *cells) = {mutate, SIR, hodge, cel, hodge, SIR, life, mutate};
+	VMState *vm = &vm_board;
+	__asm__("" : "+r"(vm)); // hide the address, GCC would fold it back into absolute LDS/STS in every inlined handler
+	AdcSnapshot knobs;
+	unsigned int ip_last = 0xFFFF, controls_last = 0xFFFF, hardware_last = 0xFFFF; // impossible start values => first pass decodes
+	unsigned char route_dirty = 0;													// hardk changed, apply its routing profile
 
 	adc_init(); // Initialize Analog Digital Converter
+	sei();		// ADC scanner and audio engine run from interrupts
 
-	initcell(cells); // Initialize Array of Cells for Sound Storage
+	seed_rng();		 // PRNG seed from the feedback noise
+	initcell(vm->cells); // Initialize Array of Cells for Sound Storage
 
 	sbi(DDRD, PORTD0); // PinD0 as out -> Switch1 -> IC40106(OSC) to filter
 	sbi(DDRD, PORTD1); // PinD1 as out -> Switch2 -> pwm to filter  (PinD6 to Filter)
@@ -1194,247 +3199,96 @@ int main(void)
 	sbi(PORTD, PORTD1); // pwm to filter
 	cbi(PORTD, PORTD2); // no feedback
 
-	instructionp = 0; // InstructionPointer selects cell value is used for the next instruction select
-	insdir = 1;		  // Step size for instruction Pointer - only changes in plwalk()
-	dir = 1;		  // Direction for the next step
-	btdir = 0;
-	dcdir = 0;
-	omem = 0;
+	audio_init(); // Start fixed rate sample output on Timer2
+
+	hardk = fhk = 0xFF; // no profile yet, the first knob decode applies both
+
+	vm_reset(vm);
+	vm_attach(vm);
+#if VM_CORES > 1
+	cores_init(vm);
+#endif
 
 	while (1)
 	{
 
-		IP = adcread(0);	   // read Poti 1 top    /  left of panel mount jack
-		hardware = adcread(1); // read Poti 2 middle /   top of panel mount jack
-		controls = adcread(2); // read Poti 3 buttom / right of panel mount jack
+		adc_snapshot(&knobs);
+		IP = knobs.ch[0];		// read Poti 1 top    /  left of panel mount jack
+		hardware = knobs.ch[1]; // read Poti 2 middle /   top of panel mount jack
+		controls = knobs.ch[2]; // read Poti 3 buttom / right of panel mount jack
 
 		if (hardware == 0)
-			hardware = instructionp;
+			hardware = vm->ip;
 		if (controls == 0)
-			controls = instructionp;
-
-		qqq = controls % 4; // Sets the filtertyp in filtermod()
-
-		cpu = IP >> 5;				// 8 CPUs  // cpu sets 1 of 8 instruction groups/algorithm
-		step = (controls % 32) + 1; // sets step to 1-32 // decided than a new plague will be created
-
-		plague = controls >> 5; // Sets plague Function
+			controls = vm->ip;
 
-		count++;
-
-		// every 1-32 steps run an algorithm
-		if (count % ((IP % 32) + 1) == 0)
+		// Decode the knobs only when they moved, the decodes are shifts and masks
+		if (IP != ip_last)
 		{
-
-			// Which instruction group/algorithm is used?
-			switch (cpu)
+			ip_last = IP;
+			cpu = IP >> 5;				// 8 CPUs  // cpu sets 1 of 8 instruction groups/algorithm
+#if VM_CORES > 1
+			cores_select(cpu);
+#endif
+			task_period(&task_cpu, ((IP & 31) + 1) * CPU_TICKS); // every 1-32 ticks run an algorithm
+		}
+		if (controls != controls_last)
+		{
+			controls_last = controls;
+			qqq = controls & 3;			// Sets the filtertyp in filtermod()
+			step = (controls & 31) + 1; // sets step to 1-32 // decided than a new plague will be created
+			plague = controls >> 5;		// Sets plague Function
+			task_period(&task_plague, step * PLAGUE_TICKS);
+		}
+		if (hardware != hardware_last)
+		{
+			hardware_last = hardware;
+			if ((hardware & 7) != hardk)
 			{
-			case 0:
-				//
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetfirst[instruction % 26])(cells, instructionp); // mistake before as was instruction%INSTLEN in last instance
-				//      insdir=dir*(IP%16)+1; // prev mistake as just got exponentially larger
-				insdir = dir; // set direction for next instruction
-				break;
-			case 1:
-				// Plague Alogrithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetplague[instruction % 8])(cells, instructionp);
-				//	    insdir=dir*(IP%16)+1;
-				insdir = dir;
-				if (cells[instructionp] == 255 && dir < 0)
-					dir = 1;
-				else if (cells[instructionp] == 255 && dir > 0)
-					dir = -1; // barrier
-				break;
-			case 2:
-				// Brain Fuck Algorithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetbf[instruction % 9])(cells, instructionp);
-				//	    insdir=dir*(IP%16)+1;
-				insdir = dir;
-				break;
-			case 3:
-				// SIR (susceptible, infected, recovered) Algorithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetSIR[instruction % 6])(cells, instructionp);
-				//	    insdir=dir*(IP%16)+1;
-				insdir = dir;
-				break;
-			case 4:
-				// Red Code Algorithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetredcode[instruction % 11])(cells, instructionp);
-				//	    insdir=dir*(IP%16)+1;
-				insdir = dir;
-				break;
-			case 5:
-				// direct output
-				instruction = cells[SAFE_IDX(instructionp)];
-				OCR0A = instruction;
-				instructionp += dir; // changed from insdir
-				break;
-			case 6:
-				// Red Death Algorithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetreddeath[instruction % 7])(cells, instructionp);
-				//	    insdir=dir*(IP%16)+1;
-				insdir = dir;
-				break;
-			case 7:
-				// la biota Algorithms
-				instruction = cells[SAFE_IDX(instructionp)];
-				instructionp = (*instructionsetbiota[instruction % 10])(cells, instructionp);
-				if (btdir == 0)
-					instructionp += 1;
-				else if (btdir == 1)
-					instructionp -= 1;
-				else if (btdir == 2)
-					instructionp += 16;
-				else if (btdir == 3)
-					instructionp -= 16;
-				break;
+				hardk = hardware & 7; // Filter or Feedback required?
+				route_dirty = 1;
 			}
+			if ((hardware >> 4) != fhk)
+			{
+				fhk = hardware >> 4; // Filter Configuration
+				filter_dirty = 1;
+			}
+		}
+
+		// every 1-32 ticks run an algorithm, timed by the scheduler instead of count % period
+		if (task_due(&task_cpu))
+		{
+#if OPCACHE
+			if (opcache_cpu != cpu)
+				opcache_fill(vm->cells, cpu); // instruction set changed
+#endif
+#if VM_CORES > 1
+			cores_run(vm);
+#else
+			vm_step(vm, cpu);
+#endif
+
+			route_modulate(vm->ip); // hardk 5 and 7 follow the CPU step rate
 		}
 
 		// Is is time for a new plaque?
-		if (count % step == 0)
-		{ // was instructionp%step
-			(*plag[plague])(cells);
+		if (task_due(&task_plague))
+		{ // was instructionp%step, then count%step
+			plague_step(plague, vm);
 		}
 
 		// Filter or Feedback required?
-		hardk = hardware % 8;
-
-		switch (hardk)
+		if (route_dirty)
 		{
-		case 0:
-			cbi(PORTD, PORTD2); // no feedback
-			break;
-		case 1:
-			PORTD |= (1 << PORTD2); // feedback
-			break;
-		case 2:
-			sbi(PORTD, PORTD0); // IC40106 to filter
-			cbi(PORTD, PORTD1); // pwm to filter = NO!
-			break;
-		case 3:
-			cbi(PORTD, PORTD0); // not IC40106 to filter
-			sbi(PORTD, PORTD1); // pwm to filter
-			break;
-		case 4:
-			// All to filter with feedback
-			PORTD |= (1 << PORTD0) | (1 << PORTD1) | (1 << PORTD2);
-			// PORTD|=instructionp&0x07;
-			break;
-		case 5:
-			if ((instructionp & 0x01) == 0x01)
-			{						// Toggle feedback through instructionp
-				cbi(PORTD, PORTD2); // no feedback
-			}
-			else
-			{
-				sbi(PORTD, PORTD2); // feedback
-			}
-			break;
-		case 6:
-			// Activate IC40106 and PWM to filter
-			PORTD |= (1 << PORTD0) | (1 << PORTD1);
-			break;
-		case 7:
-			// Toggle Routing to Filter and Feedback
-			PORTD ^= (1 << PORTD0) | (1 << PORTD1) | (1 << PORTD2);
-			// PORTD^=instructionp&0x07;
-			break;
-		default:
-			// Undefined hardk value - reset to safe state
-			hardk = 0;
-			cbi(PORTD, PORTD2); // no feedback
-			break;
+			route_dirty = 0;
+			route_apply(hardk);
 		}
 
 		// Filter Configuration
-		fhk = hardware >> 4;
-
-		switch (fhk)
+		if (filter_dirty)
 		{
-		case 0:
-			cbi(DDRB, PORTB1); // filter off
-			break;
-		case 1:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-			filterk = 8;
-			break;
-		case 2:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-			filterk = 4;
-			break;
-		case 3:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-			filterk = 2;
-			break;
-		case 4:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS10); // no divider
-			break;
-		case 5:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-			filterk = 8;
-			break;
-		case 6:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-			filterk = 4;
-			break;
-		case 7:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-			filterk = 2;
-			break;
-		case 8:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11); // divide by 8
-			break;
-		case 9:
-			sbi(DDRB, PORTB1);								   // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // divide by 64
-			filterk = 8;
-			break;
-		case 10:
-			sbi(DDRB, PORTB1);								   // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // divide by 64
-			filterk = 4;
-			break;
-		case 11:
-			sbi(DDRB, PORTB1);								   // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // divide by 64
-			filterk = 2;
-			break;
-		case 12:
-			sbi(DDRB, PORTB1);								   // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // divide by 64
-			break;
-		case 13:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS12); // 256
-			filterk = 8;
-			break;
-		case 14:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS12); // 256
-			filterk = 6;
-			break;
-		case 15:
-			sbi(DDRB, PORTB1);					 // Filter on
-			TCCR1B = (1 << WGM12) | (1 << CS12); // 256
-			filterk = 4;
-		default:
-			cbi(DDRB, PORTB1); // filter off
-			break;
+			filter_dirty = 0;
+			filter_apply(&filter_profiles[fhk]);
 		}
 	}
 	return 0;
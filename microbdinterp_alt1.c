@@ -63,6 +63,7 @@ Modified and documented by circuitnoise
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <util/atomic.h>
+#include "prng.h"
 
 /* --- Consistent 16x16 Layout ----------------------------------------- */
 #define GRID_W 16
@@ -107,24 +108,20 @@ static bool insdir_modified = false;
 int8_t cycle = -1; // signiert!
 uint8_t ostack[20];
 
-/* Complete cell memory: 256 */
-static uint8_t cells_buf[CELLS_LEN];
+/* Complete cell memory: 256, placed at 0x100 (256-aligned) through section .cells (see Makefile) */
+static uint8_t cells_buf[CELLS_LEN] __attribute__((section(".cells")));
 
 uint8_t stack[20];
 static uint8_t omem; /* remains 8-bit: Mod 256 free */
 
 static uint8_t last_cpu = 0xFF; // impossible start value => first run triggers optional
 
-/* --- Safe-Index + Wrap Helper Functions --------------------------------- */
-static inline uint16_t wrap_u16(int32_t x, uint16_t mod)
-{
-  int32_t r = x % mod;
-  return (uint16_t)(r < 0 ? r + mod : r);
-}
-#define SAFE_IDX(i) (wrap_u16((int32_t)(i), CELLS_LEN))
+/* --- Safe-Index Helper Functions ---------------------------------------- */
+/* 256 cells: the low byte is the index, negative offsets wrap the same way */
+#define SAFE_IDX(i) ((uint8_t)(i))
 
-static inline uint8_t CGET(const uint8_t *c, int32_t i) { return c[SAFE_IDX(i)]; }
-static inline void CSET(uint8_t *c, int32_t i, uint8_t v) { c[SAFE_IDX(i)] = v; }
+static inline uint8_t CGET(const uint8_t *c, uint8_t i) { return c[i]; }
+static inline void CSET(uint8_t *c, uint8_t i, uint8_t v) { c[i] = v; }
 
 static inline uint8_t clamp_filterk(uint8_t k) { return (k > 8) ? 8 : k; }
 
@@ -134,18 +131,33 @@ static inline uint8_t add_u8(uint8_t base, int16_t delta) { return (uint8_t)(bas
 #define IP_RIGHT(ip) (add_u8((ip), +1))
 
 /* --- 2D Helper Functions for 16x16 grid -------------------------------- */
+/* x is the low nibble and wraps inside the row, y the high nibble: no % */
 static inline uint8_t idx2d(int x, int y)
 {
-  x = (x % GRID_W + GRID_W) % GRID_W;
-  y = (y % GRID_H + GRID_H) % GRID_H;
-  return (uint8_t)(y * GRID_W + x);
+  return (uint8_t)(((uint8_t)y << 4) | ((uint8_t)x & 0x0F));
+}
+static inline uint8_t omem_move(uint8_t om, int8_t dx, int8_t dy)
+{
+  return (uint8_t)(((om + dx) & 0x0F) | ((om & 0xF0) + ((uint8_t)dy << 4)));
 }
-static inline uint8_t omem_move(uint8_t om, int dx, int dy)
+
+/* --- Biota directions: 0 right, 1 left, 2 down, 3 up ------------------- */
+/* bt_delta[d] is the linear step (IP), omem moves on the torus inside the
+   bits of bt_mask[d]. Turns permute d: d ^ BT_REVERSE, d ^ BT_TURN,
+   d ^ BT_UNTURN. */
+#define BT_REVERSE 1
+#define BT_TURN 2
+#define BT_UNTURN 3
+#define BT_SCAN 20 /* longest btg() walk */
+
+static const uint8_t bt_delta[4] PROGMEM = {0x01, 0xFF, 0x10, 0xF0};
+static const uint8_t bt_mask[4] PROGMEM = {0x0F, 0x0F, 0xF0, 0xF0};
+
+static inline uint8_t bt_step(uint8_t d) { return pgm_read_byte(&bt_delta[d]); }
+static inline uint8_t bt_move(uint8_t om, uint8_t d)
 {
-  int x = om % GRID_W, y = om / GRID_W;
-  x = (x + dx + GRID_W) % GRID_W;
-  y = (y + dy + GRID_H) % GRID_H;
-  return (uint8_t)(y * GRID_W + x);
+  uint8_t m = pgm_read_byte(&bt_mask[d]);
+  return (uint8_t)((om & (uint8_t)~m) | ((uint8_t)(om + bt_step(d)) & m));
 }
 
 /* --- omem increment/decrement (Mod 256 free) --------------------------- */
@@ -156,11 +168,32 @@ static inline void omem_dec(void) { omem = (uint8_t)(omem - 1); }
 /* ADC                                                                    */
 /* ---------------------------------------------------------------------- */
 
+/* ADC scanner: ADC_vect round-robins channels 0-3 into a double buffer */
+#define ADC_CHANNELS 4
+#define ADC_SEQ_LEN 4
+#define ADC_SEQ_MASK (ADC_SEQ_LEN - 1)
+#define CAPTURE_LEN 32 // feedback samples kept for mutate(), power of two
+#define CAPTURE_MASK (CAPTURE_LEN - 1)
+
+typedef struct
+{
+  uint8_t ch[ADC_CHANNELS];
+} AdcSnapshot;
+
+static const uint8_t adc_seq[ADC_SEQ_LEN] PROGMEM = {0, 1, 2, 3};
+static volatile AdcSnapshot g_adc[2];  // ISR fills g_adc[g_adc_front ^ 1]
+static volatile uint8_t g_adc_front;   // last complete sweep
+static volatile uint8_t g_adc_slot;    // sequence position of the conversion in flight
+static volatile uint8_t g_adc_frames;  // number of complete sweeps
+static volatile uint8_t g_cap[CAPTURE_LEN]; // last CAPTURE_LEN conversions of channel 3
+static volatile uint8_t g_cap_head;    // next write position in g_cap
+
 /*
 Initialize Analog Digital Converter (ADC)
 - Sets reference voltage to AVCC
 - Configures for 8-bit left-adjusted results
-- Enables ADC with 128 prescaler
+- Enables ADC with 128 prescaler in free running mode
+- ADC_vect scans channels 0-3, nobody waits for a conversion
 - Sets up Port C for analog inputs
 */
 void adc_init(void)
@@ -177,52 +210,71 @@ void adc_init(void)
   sbi(ADCSRA, ADPS1);
   sbi(ADCSRA, ADPS0);
 
-  // Enable ADC
-  sbi(ADCSRA, ADEN);
-
   // Set PortC as input (for ADC channels)
   DDRC = 0x00;
   PORTC = 0x00;
+
+  // Free running, first conversion on adc_seq[0], its MUX is latched one ADC clock after ADSC
+  g_adc_slot = 0;
+  g_adc_front = 0;
+  ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[0]);
+  ADCSRB &= (uint8_t) ~((1 << ADTS2) | (1 << ADTS1) | (1 << ADTS0));
+  ADCSRA |= (1 << ADEN) | (1 << ADATE) | (1 << ADIE) | (1 << ADSC);
+  _delay_us(16); // two ADC clocks at /128, then the MUX for the second conversion
+  ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[1]);
+}
+
+/*
+ADC scanner ISR
+The conversion after this one already runs with the old MUX setting,
+so the MUX is always programmed two slots ahead.
+*/
+ISR(ADC_vect)
+{
+  uint8_t s = g_adc_slot;
+  uint8_t v = ADCH, ch = pgm_read_byte(&adc_seq[s]);
+  g_adc[g_adc_front ^ 1].ch[ch] = v;
+  if (ch == 3)
+  {
+    g_cap[g_cap_head] = v; // feedback noise for mutate()
+    g_cap_head = (g_cap_head + 1) & CAPTURE_MASK;
+  }
+  s = (s + 1) & ADC_SEQ_MASK;
+  ADMUX = (ADMUX & 0xF8) | pgm_read_byte(&adc_seq[(s + 1) & ADC_SEQ_MASK]);
+  if (s == 0)
+  {
+    g_adc_front ^= 1;
+    g_adc_frames++;
+  }
+  g_adc_slot = s;
 }
 
 /*
 Read ADC value from specified channel
 Parameters:
-- channel: ADC input channel (0-7)
-Returns: 8-bit conversion result
+- channel: ADC input channel (0-3 are scanned)
+Returns: latest 8-bit conversion result, never blocks
 */
 uint8_t adcread(uint8_t channel)
 {
-  if (!(ADCSRA & (1 << ADEN)) || channel > 7)
+  if (channel >= ADC_CHANNELS)
     return 0;
+  return g_adc[g_adc_front].ch[channel];
+}
 
-  // Kanal setzen (REFSx/ADLAR bleiben erhalten)
-  ADMUX = (ADMUX & 0xF8) | (channel & 0x07);
-
-  // ADIF vor Messablauf löschen (write-1-to-clear)
-  ADCSRA |= (1 << ADIF);
-
-  // Dummy conversion after MUX change (discard first sample)
-  ADCSRA |= (1 << ADSC);
-  while (ADCSRA & (1 << ADSC))
-  {
-  }
-  (void)ADCH; // Discard dummy value
+/* Copy the last complete sweep of all channels */
+static inline void adc_snapshot(AdcSnapshot *snap)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { *snap = g_adc[g_adc_front]; }
+}
 
-  // Actual measurement
-  ADCSRA |= (1 << ADSC);
-  uint16_t timeout = 10000;
-  while ((ADCSRA & (1 << ADSC)) && --timeout)
+/* Wait for the next complete sweep (boot only) */
+static inline void adc_wait(void)
+{
+  uint8_t frame = g_adc_frames;
+  while (frame == g_adc_frames)
   {
   }
-  if (!timeout)
-    return 0;
-
-  // ADIF nach Abschluss löschen (optional, aber sauber)
-  ADCSRA |= (1 << ADIF);
-
-  // left-justified -> upper byte
-  return ADCH;
 }
 
 /*
@@ -233,6 +285,7 @@ void initcell(uint8_t *cells)
 {
   for (uint16_t x = 0; x < CELLS_LEN; x++)
   {
+    adc_wait();            // fresh sample for every cell
     cells[x] = adcread(3); // get output signal
   }
 }
@@ -582,18 +635,6 @@ uint8_t SIRoutp(uint8_t *cells, uint8_t IP)
   return (uint8_t)(IP + insdir);
 }
 
-/* --------- Leichtgewichtiger PRNG (ersetzt rand()) --------- */
-static uint8_t lfsr = 0xA5;
-static inline uint8_t prng8(void)
-{
-  uint8_t x = lfsr;
-  x ^= (uint8_t)(x << 3);
-  x ^= (uint8_t)(x >> 5);
-  x ^= (uint8_t)(x << 1);
-  lfsr = x;
-  return x;
-}
-
 uint8_t SIRincif(uint8_t *cells, uint8_t IP)
 {
   if ((CGET(cells, (int32_t)IP + 1) > 0 && CGET(cells, (int32_t)IP + 1) < 128))
@@ -605,7 +646,7 @@ uint8_t SIRdieif(uint8_t *cells, uint8_t IP)
 {
   if ((CGET(cells, (int32_t)IP + 1) > 0 && CGET(cells, (int32_t)IP + 1) < 128))
   {
-    if ((prng8() % 10) < 4)
+    if (prng8() < PRNG_P10(4)) // 4 in 10
       CSET(cells, IP, dead);
   }
   return (uint8_t)(IP + insdir);
@@ -625,7 +666,7 @@ uint8_t SIRinfif(uint8_t *cells, uint8_t IP)
     if ((CGET(cells, (int32_t)IP - 1) > 0 && CGET(cells, (int32_t)IP - 1) < 128) ||
         (CGET(cells, (int32_t)IP + 1) > 0 && CGET(cells, (int32_t)IP + 1) < 128))
     {
-      if ((prng8() % 10) < 4)
+      if (prng8() < PRNG_P10(4)) // 4 in 10
         CSET(cells, IP, 1);
     }
   }
@@ -734,17 +775,11 @@ uint8_t rdoutp(uint8_t *cells, uint8_t IP)
 /* instructionsetbiota                                                    */
 /* ---------------------------------------------------------------------- */
 
+static inline void bt_reverse(void) { btdir ^= BT_REVERSE; }
+
 uint8_t btempty(uint8_t *cells, uint8_t IP)
 {
-  // turn around
-  if (btdir == 0)
-    btdir = 1;
-  else if (btdir == 1)
-    btdir = 0;
-  else if (btdir == 2)
-    btdir = 3;
-  else if (btdir == 3)
-    btdir = 2;
+  bt_reverse(); // turn around
   return IP;
 }
 
@@ -762,110 +797,47 @@ uint8_t btoutp(uint8_t *cells, uint8_t IP)
 
 uint8_t btstraight(uint8_t *cells, uint8_t IP)
 {
-  if (dcdir == 0)
-    omem = omem_move(omem, +1, 0);
-  else if (dcdir == 1)
-    omem = omem_move(omem, -1, 0);
-  else if (dcdir == 2)
-    omem = omem_move(omem, 0, +1);
-  else if (dcdir == 3)
-    omem = omem_move(omem, 0, -1);
-
+  omem = bt_move(omem, dcdir);
   if (cells[omem] == 0)
-  { // change dir
-    if (btdir == 0)
-      btdir = 1;
-    else if (btdir == 1)
-      btdir = 0;
-    else if (btdir == 2)
-      btdir = 3;
-    else if (btdir == 3)
-      btdir = 2;
-  }
+    bt_reverse(); // change dir
   return IP;
 }
 
 uint8_t btbackup(uint8_t *cells, uint8_t IP)
 {
-  if (dcdir == 0)
-    omem = omem_move(omem, -1, 0);
-  else if (dcdir == 1)
-    omem = omem_move(omem, +1, 0);
-  else if (dcdir == 2)
-    omem = omem_move(omem, 0, -1);
-  else if (dcdir == 3)
-    omem = omem_move(omem, 0, +1);
+  omem = bt_move(omem, dcdir ^ BT_REVERSE);
   if (cells[omem] == 0)
-  {
-    if (btdir == 0)
-      btdir = 1;
-    else if (btdir == 1)
-      btdir = 0;
-    else if (btdir == 2)
-      btdir = 3;
-    else if (btdir == 3)
-      btdir = 2;
-  }
+    bt_reverse();
   return IP;
 }
 
 uint8_t btturn(uint8_t *cells, uint8_t IP)
 {
-  if (dcdir == 0)
-    omem = omem_move(omem, 0, +1);
-  else if (dcdir == 1)
-    omem = omem_move(omem, 0, -1);
-  else if (dcdir == 2)
-    omem = omem_move(omem, +1, 0);
-  else if (dcdir == 3)
-    omem = omem_move(omem, -1, 0);
+  omem = bt_move(omem, dcdir ^ BT_TURN);
   return IP;
 }
 
 uint8_t btunturn(uint8_t *cells, uint8_t IP)
 {
-  if (dcdir == 0)
-    omem = omem_move(omem, 0, -1);
-  else if (dcdir == 1)
-    omem = omem_move(omem, 0, +1);
-  else if (dcdir == 2)
-    omem = omem_move(omem, -1, 0);
-  else if (dcdir == 3)
-    omem = omem_move(omem, +1, 0);
+  omem = bt_move(omem, dcdir ^ BT_UNTURN);
   return IP;
 }
 
+/* next zero cell along dcdir, at most BT_SCAN steps, tables read once */
 uint8_t btg(uint8_t *cells, uint8_t IP)
 {
-  uint8_t x = 0;
-  while (x < 20 && cells[omem] != 0)
-  {
-    if (dcdir == 0)
-      omem = omem_move(omem, +1, 0);
-    else if (dcdir == 1)
-      omem = omem_move(omem, -1, 0);
-    else if (dcdir == 2)
-      omem = omem_move(omem, 0, +1);
-    else if (dcdir == 3)
-      omem = omem_move(omem, 0, -1);
-    x++;
-  }
+  uint8_t x = BT_SCAN, m = pgm_read_byte(&bt_mask[dcdir]), d = bt_step(dcdir);
+  uint8_t keep = omem & (uint8_t)~m, om = omem;
+  while (cells[om] != 0 && x--)
+    om = keep | ((uint8_t)(om + d) & m);
+  omem = om;
   return IP;
 }
 
 uint8_t btclear(uint8_t *cells, uint8_t IP)
 {
   if (cells[omem] == 0)
-  {
-    if (btdir == 0)
-      btdir = 1;
-    else if (btdir == 1)
-      btdir = 0;
-    else if (btdir == 2)
-      btdir = 3;
-    else if (btdir == 3)
-      btdir = 2;
-  }
+    bt_reverse();
   else
     CSET(cells, omem, 0);
   return IP;
@@ -874,16 +846,7 @@ uint8_t btclear(uint8_t *cells, uint8_t IP)
 uint8_t btdup(uint8_t *cells, uint8_t IP)
 {
   if (cells[omem] == 0 || CGET(cells, (int32_t)omem - 1) != 0)
-  {
-    if (btdir == 0)
-      btdir = 1;
-    else if (btdir == 1)
-      btdir = 0;
-    else if (btdir == 2)
-      btdir = 3;
-    else if (btdir == 3)
-      btdir = 2;
-  }
+    bt_reverse();
   else
     CSET(cells, (int32_t)omem - 1, cells[omem]);
   return IP;
@@ -912,7 +875,7 @@ uint8_t reddeath(uint8_t *cells, uint8_t IP)
   if (clock == 13)
   {
     clock = 13;
-    count = (uint8_t)((count + 1) % CELLS_LEN);
+    count = (uint8_t)(count + 1);
     CSET(cells, (int32_t)IP + count, adcread(3)); // get output signal
     return IP;                                    // just keeps on going
   }
@@ -979,15 +942,7 @@ uint8_t redunmask(uint8_t *cells, uint8_t IP)
 
 uint8_t redprospero(uint8_t *cells, uint8_t IP)
 {
-  uint8_t dirrr = adcread(3) % 4; // get output signal
-  if (dirrr == 0)
-    omem = omem_move(omem, +1, 0);
-  else if (dirrr == 1)
-    omem = omem_move(omem, -1, 0);
-  else if (dirrr == 2)
-    omem = omem_move(omem, 0, +1);
-  else if (dirrr == 3)
-    omem = omem_move(omem, 0, -1);
+  omem = bt_move(omem, adcread(3) & 3); // get output signal
 
   OCR0A = cells[omem];
   return (uint8_t)(IP + insdir);
@@ -1005,14 +960,21 @@ uint8_t redoutside(uint8_t *cells, uint8_t IP)
 /* ---------------------------------------------------------------------- */
 
 /*
-  Plaque Mutate changes cell values to values from Filter Output until cells[0] value is reached
+  Plaque Mutate changes cells[0] cells per call with values from Filter Output
+  The samples come from g_cap, filled by the ADC ISR, so no conversion is
+  waited for. Each lap over the ring adds an odd offset, a sample used again
+  hits another cell instead of undoing its own flip.
 */
 void mutate(uint8_t *cells)
 {
-  uint8_t x, y;
-  for (y = 0; y < cells[0]; y++)
+  static uint8_t r = 0, lap = 0;
+  uint8_t n = cells[0];
+  while (n--)
   {
-    x = adcread(3);         // Read output signal
+    uint8_t x = (uint8_t)(g_cap[r] + lap);
+    r = (r + 1) & CAPTURE_MASK;
+    if (r == 0)
+      lap += 61; // odd, walks all 256 offsets
     cells[x] ^= (x & 0x0f); // 0b00001111
   }
 }
@@ -1216,7 +1178,7 @@ void SIR(uint8_t *cellies)
           (cells[x - 1] > 0 && cells[x - 1] < kk) ||
           (cells[x + 1] > 0 && cells[x + 1] < kk))
       {
-        if ((prng8() % 10) < p)
+        if (prng_p10(p))
           newcells[x] = 1;
       }
     }
@@ -1264,40 +1226,16 @@ void life(uint8_t *cellies)
   flag ^= 0x01;
 }
 
-/* Seed für PRNG (LFSR) aus ADC-Rauschen */
+/* Seed für PRNG (prng.h) aus ADC-Rauschen */
 void seed_rng(void)
 {
   uint8_t seed = 0;
   for (int i = 0; i < 16; i++)
   {
+    adc_wait();
     seed ^= adcread(3);
-    _delay_us(50);
-  }
-  if (seed == 0)
-    seed = 0xA5; // Fallback
-  lfsr ^= seed;
-}
-
-/* --------------------------------------------------------------------------
-   ADC-Cache (polling, throttled)
-   -------------------------------------------------------------------------- */
-typedef struct
-{
-  uint8_t ch0, ch1, ch2, ch3;
-} AdcSnapshot;
-static AdcSnapshot g_adc;       // Current values
-static uint16_t g_adc_tick = 0; // Clock for throttling
-
-// Update all potentiometers every 16 iterations
-static inline void adc_poll_throttled(void)
-{
-  if ((g_adc_tick++ & 0x0F) == 0)
-  {
-    g_adc.ch0 = adcread(0);
-    g_adc.ch1 = adcread(1);
-    g_adc.ch2 = adcread(2);
-    g_adc.ch3 = adcread(3);
   }
+  prng_seed(seed);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -1306,9 +1244,8 @@ static inline void adc_poll_throttled(void)
 
 int main(void)
 {
-  seed_rng();
-
   uint8_t *cells = cells_buf;
+  AdcSnapshot knobs;
 
   // CPU Functions // Instruction Groups
   uint8_t (*instructionsetfirst[])(uint8_t *cells, uint8_t IP) =
@@ -1335,7 +1272,9 @@ int main(void)
   // Plague Function Group
   void (*plag[])(uint8_t *cells) = {mutate, SIR, hodge, cel, hodge, SIR, life, mutate};
 
-  adc_init();      // Initialize ADC
+  adc_init(); // Initialize ADC scanner
+  sei();
+  seed_rng();
   initcell(cells); // Initialize Array of Cells for Sound Storage (jetzt 256 Zellen)
 
   sbi(DDRD, PORTD0); // PinD0 as out -> Switch1 -> IC40106(OSC) to filter
@@ -1364,11 +1303,11 @@ int main(void)
 
   while (1)
   {
-    // --- ADC-Cache ---
-    adc_poll_throttled();
-    IP = g_adc.ch0;       // Poti 1
-    hardware = g_adc.ch1; // Poti 2
-    controls = g_adc.ch2; // Poti 3
+    // --- ADC snapshot (filled by ADC_vect) ---
+    adc_snapshot(&knobs);
+    IP = knobs.ch[0];       // Poti 1
+    hardware = knobs.ch[1]; // Poti 2
+    controls = knobs.ch[2]; // Poti 3
 
     if (hardware == 0)
       hardware = instructionp;
@@ -1429,14 +1368,7 @@ int main(void)
       case 7:
         instruction = cells[instructionp];
         instructionp = (*instructionsetbiota[instruction % 10])(cells, instructionp);
-        if (btdir == 0)
-          instructionp += 1;
-        else if (btdir == 1)
-          instructionp -= 1;
-        else if (btdir == 2)
-          instructionp += 16;
-        else if (btdir == 3)
-          instructionp -= 16;
+        instructionp += bt_step(btdir);
         break;
       }
       if (!insdir_modified)
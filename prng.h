@@ -0,0 +1,112 @@
+/*
+prng.h - small pseudo random generators, shared by both firmwares
+
+Replaces avr-libc rand() (32 bit LCG, multiply and modulo) with generators
+that cost a few shifts and xors per byte. Select one with PRNG before the
+include:
+
+  PRNG_XORSHIFT8  8 bit xorshift (3, 5, 4), period 255, fastest
+  PRNG_LFSR16     16 bit Fibonacci LFSR (taps 16 14 13 11), 8 shifts per byte, period 65535
+  PRNG_GALOIS16   16 bit Galois LFSR (0xB400), 8 shifts per byte, period 65535
+
+rand() % 10 < p becomes one compare: prng8() < PRNG_P10(p) for a constant p,
+prng_p10(p) for a variable one.
+*/
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#define PRNG_XORSHIFT8 0
+#define PRNG_LFSR16 1
+#define PRNG_GALOIS16 2
+
+#ifndef PRNG
+#define PRNG PRNG_XORSHIFT8
+#endif
+
+static uint16_t prng_state = 0xACE1; // never 0
+
+/*
+Next random byte
+*/
+static inline uint8_t prng8(void)
+{
+#if PRNG == PRNG_XORSHIFT8
+  uint8_t x = (uint8_t)prng_state;
+  x ^= (uint8_t)(x << 3);
+  x ^= (uint8_t)(x >> 5);
+  x ^= (uint8_t)(x << 4);
+  prng_state = x;
+  return x;
+#elif PRNG == PRNG_LFSR16
+  uint16_t x = prng_state;
+  uint8_t i, bit;
+  for (i = 0; i < 8; i++)
+  {
+    bit = (uint8_t)(x ^ (x >> 2) ^ (x >> 3) ^ (x >> 5)) & 1;
+    x = (x >> 1) | ((uint16_t)bit << 15);
+  }
+  prng_state = x;
+  return (uint8_t)x;
+#elif PRNG == PRNG_GALOIS16
+  uint16_t x = prng_state;
+  uint8_t i;
+  for (i = 0; i < 8; i++)
+  {
+    if (x & 1)
+      x = (x >> 1) ^ 0xB400;
+    else
+      x >>= 1;
+  }
+  prng_state = x;
+  return (uint8_t)x;
+#else
+#error "unknown PRNG"
+#endif
+}
+
+/*
+Mix a seed (ADC noise) into the state, the state never becomes 0
+*/
+static inline void prng_seed(uint8_t seed)
+{
+  prng_state ^= ((uint16_t)seed << 8) | seed;
+#if PRNG == PRNG_XORSHIFT8
+  if ((uint8_t)prng_state == 0)
+#else
+  if (prng_state == 0)
+#endif
+    prng_state = 0xACE1; // Fallback
+}
+
+/*
+Fill n bytes in one go
+*/
+static inline void prng_fill(uint8_t *buf, uint8_t n)
+{
+  while (n--)
+    *buf++ = prng8();
+}
+
+/*
+Thresholds for rand() % 10 < p: p / 10 of the 256 byte values
+*/
+#define PRNG_P10(p) ((uint8_t)((256U * (p) + 5) / 10)) // p = 0..9
+
+static const uint8_t prng_p10_table[10] PROGMEM = {
+    PRNG_P10(0), PRNG_P10(1), PRNG_P10(2), PRNG_P10(3), PRNG_P10(4),
+    PRNG_P10(5), PRNG_P10(6), PRNG_P10(7), PRNG_P10(8), PRNG_P10(9)};
+
+/*
+1 with probability min(p, 10) / 10, like rand() % 10 < p
+*/
+static inline uint8_t prng_p10(uint8_t p)
+{
+  if (p >= 10)
+    return 1;
+  return prng8() < pgm_read_byte(&prng_p10_table[p]);
+}
+
+#endif